@@ -11,74 +11,489 @@
 #include "pin.H"
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <iomanip>
 #include <math.h>
-#include <unordered_set>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+#include "../common/pin_runtime.H"
 #include <vector>
-#include <chrono>
+#include <map>
 
 using namespace std;
 
 #define ONE_BILLION 1e+9
+#define ONE_MILLION 1000000ULL
+#define CACHE_LINE_SIZE 64
+
+#define INS_LEN_BUCKETS 16
+#define OPERAND_BUCKETS 8
+
+#define SIMPOINT_DIMS 15            // dimensions of the projected basic block vectors
+#define SIMPOINT_SEEDS 5            // k-means restarts per cluster count
+#define SIMPOINT_ITERATIONS 100
+#define SIMPOINT_BIC_FRACTION 0.9   // smallest k whose BIC reaches this fraction of the best
 
-std::chrono::high_resolution_clock::time_point t_start;
-std::chrono::high_resolution_clock::time_point t_end;
 /* ================================================================== */
 // Structures
 /* ================================================================== */
 
-typedef struct InsCategoryCount {
-    // Will be instrumented for only true predicates
-    UINT32 loads;
-    UINT32 stores;
-    UINT32 nop;
-    UINT32 directCall;
-    UINT32 indirectCall;
-    UINT32 returns;
-    UINT32 unconditionalBranch;
-    UINT32 conditionalBranch;
-    UINT32 logicalOps;
-    UINT32 rotateAndShift;
-    UINT32 flagOps;
-    UINT32 vectorIns;
-    UINT32 conditionalMoves;
-    UINT32 mmxSSEIns;
-    UINT32 syscalls;
-    UINT32 fpIns;
-    UINT32 others;
-} InsCategoryCount;
+// Instruction categories, loads and stores are only counted for true predicates
+enum InsCategory {
+    cat_loads,
+    cat_stores,
+    cat_nop,
+    cat_direct_call,
+    cat_indirect_call,
+    cat_returns,
+    cat_unconditional_branch,
+    cat_conditional_branch,
+    cat_logical_ops,
+    cat_rotate_and_shift,
+    cat_flag_ops,
+    cat_vector_ins,
+    cat_conditional_moves,
+    cat_mmx_sse_ins,
+    cat_syscalls,
+    cat_fp_ins,
+    cat_others,
+
+    category_count
+};
+
+static vector<string> category_names = {"Loads", "Stores", "Nop", "DirectCall", "IndirectCall", "Returns",
+                                        "UnconditionalBranch", "ConditionalBranch", "LogicalOps",
+                                        "RotateAndShift", "FlagOps", "VectorIns", "ConditionalMoves",
+                                        "MmxSSEIns", "Syscalls", "FpIns", "Others"};
+
+// ISA extension groups, from INS_Extension
+enum IsaExtension {
+    ext_base,
+    ext_x87,
+    ext_mmx,
+    ext_sse,
+    ext_avx,
+    ext_avx2,
+    ext_avx512,
+    ext_fma,
+    ext_bmi,
+    ext_other,
+
+    extension_count
+};
+
+static vector<string> extension_names = {"Base", "x87", "MMX", "SSE", "AVX", "AVX2", "AVX-512", "FMA", "BMI", "Other"};
+
+// Operation width of SIMD instructions; scalar SIMD (e.g. addsd) is what unvectorised FP code looks like
+enum VectorWidth {
+    width_none,
+    width_scalar,
+    width_64,
+    width_128,
+    width_256,
+    width_512,
+
+    width_count
+};
+
+static vector<string> width_names = {"None", "Scalar", "64", "128", "256", "512"};
+
+/*
+ * Every statistic the profiler reports. Event counters are 64-bit so
+ * windows of many billions of instructions cannot wrap them; extrema are
+ * kept at their natural width. Merge() folds another shard into this one.
+ * The histograms are inline arrays so that the whole block is one flat
+ * allocation and instrumentation can name a counter by its offset.
+ */
+typedef struct InsStats {
+    UINT64 categories[category_count];  // dynamic count of different category ins executed
+    UINT64 extensions[extension_count];
+    UINT64 vectorWidths[width_count];
+
+    UINT64 insLenCount[INS_LEN_BUCKETS];
+    UINT64 numOperandsCount[OPERAND_BUCKETS];
+    UINT64 regReadOperandsCount[OPERAND_BUCKETS];
+    UINT64 regWriteOperandsCount[OPERAND_BUCKETS];
+    UINT64 memOpsCount[OPERAND_BUCKETS];
+    UINT64 readMemOpsCount[OPERAND_BUCKETS];
+    UINT64 writeMemOpsCount[OPERAND_BUCKETS];
+
+    UINT64 totalMemIns;         // instruction having atleast one memory operands
+    UINT64 bytesAccessed;
+    UINT32 maxBytesAccessed;
+
+    INT32 maxImmediate;
+    INT32 minImmediate;
+
+    ADDRDELTA minDisp;
+    ADDRDELTA maxDisp;
+
+    UINT64 cacheHits;           // data cache line accesses, only with -cache
+    UINT64 cacheMisses;
+
+    InsStats()
+        : totalMemIns(0), bytesAccessed(0), maxBytesAccessed(0), maxImmediate(-INT_MAX), minImmediate(INT_MAX),
+          minDisp(INT_MAX), maxDisp(-INT_MAX), cacheHits(0), cacheMisses(0)
+    {
+        memset(categories, 0, sizeof(categories));
+        memset(extensions, 0, sizeof(extensions));
+        memset(vectorWidths, 0, sizeof(vectorWidths));
+        memset(insLenCount, 0, sizeof(insLenCount));
+        memset(numOperandsCount, 0, sizeof(numOperandsCount));
+        memset(regReadOperandsCount, 0, sizeof(regReadOperandsCount));
+        memset(regWriteOperandsCount, 0, sizeof(regWriteOperandsCount));
+        memset(memOpsCount, 0, sizeof(memOpsCount));
+        memset(readMemOpsCount, 0, sizeof(readMemOpsCount));
+        memset(writeMemOpsCount, 0, sizeof(writeMemOpsCount));
+    }
+
+    UINT64 TotalCategoryCount() const {
+        UINT64 total = 0;
+        for (UINT32 i = 0; i < category_count; i++)
+            total += categories[i];
+        return total;
+    }
+
+    VOID Merge(const InsStats& other) {
+        for (UINT32 i = 0; i < category_count; i++)
+            categories[i] += other.categories[i];
+        MergeHistogram(extensions, other.extensions, extension_count);
+        MergeHistogram(vectorWidths, other.vectorWidths, width_count);
+
+        MergeHistogram(insLenCount, other.insLenCount, INS_LEN_BUCKETS);
+        MergeHistogram(numOperandsCount, other.numOperandsCount, OPERAND_BUCKETS);
+        MergeHistogram(regReadOperandsCount, other.regReadOperandsCount, OPERAND_BUCKETS);
+        MergeHistogram(regWriteOperandsCount, other.regWriteOperandsCount, OPERAND_BUCKETS);
+        MergeHistogram(memOpsCount, other.memOpsCount, OPERAND_BUCKETS);
+        MergeHistogram(readMemOpsCount, other.readMemOpsCount, OPERAND_BUCKETS);
+        MergeHistogram(writeMemOpsCount, other.writeMemOpsCount, OPERAND_BUCKETS);
+
+        totalMemIns += other.totalMemIns;
+        bytesAccessed += other.bytesAccessed;
+        maxBytesAccessed = max(maxBytesAccessed, other.maxBytesAccessed);
+        maxImmediate = max(maxImmediate, other.maxImmediate);
+        minImmediate = min(minImmediate, other.minImmediate);
+        maxDisp = max(maxDisp, other.maxDisp);
+        minDisp = min(minDisp, other.minDisp);
+        cacheHits += other.cacheHits;
+        cacheMisses += other.cacheMisses;
+    }
+
+private:
+    static VOID MergeHistogram(UINT64* into, const UINT64* from, UINT32 buckets) {
+        for (UINT32 i = 0; i < buckets; i++)
+            into[i] += from[i];
+    }
+} InsStats;
+
+// Execution count of one basic block in the current simulation point interval
+typedef struct BbvBlock {
+    UINT64 count;       // instructions executed in this block during the interval
+    UINT32 id;
+} BbvBlock;
+
+/*
+ * Instructions of one routine by ISA extension and vector width, for the
+ * top routines report. Shared by all threads and updated atomically.
+ */
+typedef struct RoutineStats {
+    string name;
+    UINT64 ins;
+    UINT64 counts[extension_count + width_count];  // extensions, then vector widths
+} RoutineStats;
+
+// Byte offset of a counter inside InsStats; the thread running the code supplies the block
+#define STAT_OFFSET(counter) ((UINT32)offsetof(InsStats, counter))
+#define STAT_BUCKET(histogram, i) (STAT_OFFSET(histogram) + (UINT32)(i) * sizeof(UINT64))
+
+/*
+ * Static contribution of one basic block, built at instrumentation time and
+ * applied with a single call per execution. Counters are (offset, increment)
+ * pairs; footprint blocks only need adding on the first execution in each
+ * footprint epoch since repeating them changes nothing.
+ */
+typedef struct BblDelta {
+    vector< pair<UINT32, UINT32> > counters;  // (InsStats offset, increment)
+    UINT32 numIns;
+    UINT64 bytesAccessed;
+
+    UINT32 seenEpoch;   // footprint epoch in which the instruction lines were last added
+
+    RoutineStats* routine;                          // NULL unless routines are profiled
+    vector< pair<UINT32, UINT32> > routineCounts;   // (RoutineStats::counts index, increment)
+    vector<UINT64> insBlocks;
+    INT32 maxImmediate;
+    INT32 minImmediate;
+    UINT32 maxBytesAccessed;
+} BblDelta;
+
+#define FOOTPRINT_PAGE_BITS 12                          // blocks covered by one leaf, as a power of two
+#define FOOTPRINT_LEAF_WORDS ((1 << FOOTPRINT_PAGE_BITS) / 64)
+
+/*
+ * Set of 32-byte block numbers kept as a two-level sparse bitmap: a
+ * directory of pages, each page a 512-byte bit array. Consecutive accesses
+ * to the same block or page skip the directory lookup, and a page is only
+ * allocated the first time one of its blocks is touched.
+ */
+class BlockBitmap {
+public:
+    BlockBitmap() : lastBlock(~0ULL), lastPage(~0ULL), lastLeaf(NULL), count(0) {}
+
+    inline VOID Insert(UINT64 block) {
+        if (block == lastBlock)
+            return;
+        lastBlock = block;
+
+        UINT64 page = block >> FOOTPRINT_PAGE_BITS;
+        if (page != lastPage) {
+            lastLeaf = Leaf(page);
+            lastPage = page;
+        }
+
+        UINT32 bit = block & ((1 << FOOTPRINT_PAGE_BITS) - 1);
+        UINT64 mask = 1ULL << (bit & 63);
+        if (!(lastLeaf[bit >> 6] & mask)) {
+            lastLeaf[bit >> 6] |= mask;
+            count++;
+        }
+    }
+
+    // Number of distinct blocks inserted
+    UINT64 size() const { return count; }
+
+    // Union with another set
+    VOID Merge(const BlockBitmap& other) {
+        for (unordered_map<UINT64, UINT64*>::const_iterator it = other.directory.begin(); it != other.directory.end(); ++it) {
+            UINT64* leaf = Leaf(it->first);
+            for (UINT32 w = 0; w < FOOTPRINT_LEAF_WORDS; w++) {
+                count += __builtin_popcountll(it->second[w] & ~leaf[w]);
+                leaf[w] |= it->second[w];
+            }
+        }
+    }
+
+private:
+    UINT64* Leaf(UINT64 page) {
+        UINT64*& leaf = directory[page];
+        if (leaf == NULL)
+            leaf = new UINT64[FOOTPRINT_LEAF_WORDS]();
+        return leaf;
+    }
+
+    unordered_map<UINT64, UINT64*> directory;
+    UINT64 lastBlock;
+    UINT64 lastPage;
+    UINT64* lastLeaf;
+    UINT64 count;
+};
+
+#define HLL_MIN_PRECISION 4
+#define HLL_MAX_PRECISION 18
+
+/*
+ * HyperLogLog cardinality sketch with 2^precision one-byte registers. The
+ * relative standard error is about 1.04 / sqrt(2^precision) and memory
+ * stays fixed however many blocks are inserted. Insert() is safe to call
+ * from several threads at once.
+ */
+class HyperLogLog {
+public:
+    HyperLogLog(UINT32 precision = HLL_MIN_PRECISION) : p(precision), registers(1 << precision, 0) {}
+
+    inline VOID Insert(UINT64 value) {
+        // splitmix64 finaliser
+        UINT64 h = value + 0x9e3779b97f4a7c15ULL;
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        h ^= h >> 31;
+
+        UINT32 index = h >> (64 - p);
+        UINT64 rest = (h << p) | (1ULL << (p - 1));
+        UINT8 rank = __builtin_clzll(rest) + 1;
+
+        // Registers only grow, so threads can share a sketch with a compare-and-swap
+        UINT8 current = registers[index];
+        while (rank > current) {
+            UINT8 seen = __sync_val_compare_and_swap(&registers[index], current, rank);
+            if (seen == current)
+                break;
+            current = seen;
+        }
+    }
+
+    double Estimate() const {
+        double m = registers.size();
+        double sum = 0;
+        UINT32 zeros = 0;
+        for (UINT32 i = 0; i < registers.size(); i++) {
+            sum += ldexp(1.0, -registers[i]);
+            zeros += (registers[i] == 0);
+        }
+
+        double alpha = 0.7213 / (1 + 1.079 / m);
+        double estimate = alpha * m * m / sum;
+
+        // Small range correction: linear counting over the empty registers
+        if (estimate <= 2.5 * m && zeros)
+            estimate = m * log(m / zeros);
+        return estimate;
+    }
+
+    VOID Clear() { fill(registers.begin(), registers.end(), 0); }
+
+    // Precision giving at most the requested relative standard error
+    static UINT32 PrecisionFor(double error) {
+        UINT32 precision = HLL_MIN_PRECISION;
+        while (precision < HLL_MAX_PRECISION && 1.04 / sqrt((double)(1 << precision)) > error)
+            precision++;
+        return precision;
+    }
+
+private:
+    UINT32 p;
+    vector<UINT8> registers;
+};
+
+/*
+ * Set-associative data cache with LRU replacement, tags only. Used to
+ * split memory accesses into hits and misses for the CPI model; each
+ * thread simulates its own private copy.
+ */
+class DataCache {
+public:
+    DataCache() : sets(0), ways(0), lineBits(0), clock(0) {}
+
+    DataCache(UINT32 size, UINT32 ways, UINT32 line)
+        : sets(size / (ways * line)), ways(ways), lineBits(0), clock(0)
+    {
+        while ((1U << lineBits) < line)
+            lineBits++;
+        tags.assign(sets * ways, ~0ULL);
+        stamps.assign(sets * ways, 0);
+    }
+
+    BOOL Enabled() const { return sets != 0; }
+
+    // Touch every line of [addr, addr + size), counting hits and misses
+    inline VOID Access(ADDRINT addr, UINT32 size, UINT64& hits, UINT64& misses) {
+        UINT64 last = (addr + (size ? size - 1 : 0)) >> lineBits;
+        for (UINT64 line = addr >> lineBits; line <= last; line++) {
+            if (AccessLine(line))
+                hits++;
+            else
+                misses++;
+        }
+    }
+
+private:
+    BOOL AccessLine(UINT64 line) {
+        UINT32 base = (line & (sets - 1)) * ways;
+        UINT32 victim = base;
+        for (UINT32 w = base; w < base + ways; w++) {
+            if (tags[w] == line) {
+                stamps[w] = ++clock;
+                return true;
+            }
+            if (stamps[w] < stamps[victim])
+                victim = w;
+        }
+        tags[victim] = line;
+        stamps[victim] = ++clock;
+        return false;
+    }
+
+    UINT32 sets;
+    UINT32 ways;
+    UINT32 lineBits;
+    UINT64 clock;
+    vector<UINT64> tags;
+    vector<UINT64> stamps;
+};
+
+/*
+ * First-order performance model: every counted event of a category costs
+ * its latency, and memory accesses add either a flat penalty per load or
+ * store unit or, with a cache model, a hit or miss latency per line.
+ * The defaults reproduce the old (loads + stores) * 69 + total formula.
+ */
+typedef struct CpiModel {
+    double latency[category_count];
+    double memoryLatency;
+    double hitLatency;
+    double missLatency;
+} CpiModel;
 
 /* ================================================================== */
 // Global variables
 /* ================================================================== */
 
-InsCategoryCount insCategoryCount = {0}; // dynamic count of different category ins executed
-UINT32 insCategoryTotalCount = 0;
-UINT32 CPI;
+/*
+ * Per-thread counter block. The padding on either side keeps two threads'
+ * counters off the same cache line whatever the allocator places next to it.
+ */
+typedef struct ThreadStats {
+    UINT8 padBefore[CACHE_LINE_SIZE];
+    InsStats stats;
+    BlockBitmap dataFootprint;
+    DataCache cache;
+    THREADID tid;
+    UINT8 padAfter[CACHE_LINE_SIZE];
+} ThreadStats;
+
+TLS_KEY tls_key;
+PIN_LOCK stats_lock;            // guards threadStats
+PIN_LOCK footprint_lock;        // guards the shared instruction footprint and interval bookkeeping
+vector<ThreadStats*> threadStats;
+
+UINT32 topRoutines = 0;
+PIN_LOCK routine_lock;
+map<ADDRINT, RoutineStats*> routines;
+
+CpiModel cpiModel;
+DataCache cacheProto;           // geometry every thread's private cache is copied from
+double CPI;
+UINT64 cpiInterval = 0;
+UINT64 nextCpiInterval = 0;
+UINT64 prevIntervalIns = 0;
+double prevIntervalCycles = 0;
+vector<double> intervalCpi;
 
-UINT64 fastForwardCount;
-UINT64 insCount    = 0; //number of dynamically executed instructions
 UINT64 analysedInsCount = 0;
 
-unordered_set<UINT32> unqiue_data;
-unordered_set<UINT32> unique_ins;
-
-vector<UINT32> insLenCount(16, 0);
-vector<UINT32> numOperandsCount(8, 0);
-vector<UINT32> regReadOperandsCount(8,0);
-vector<UINT32> regWriteOperandsCount(8,0);
-vector<UINT32> memOpsCount(8,0);
-vector<UINT32> readMemOpsCount(8,0);
-vector<UINT32> writeMemOpsCount(8,0);
-UINT32 maxBytesAccessed = 0;
-UINT64 avgBytesAccessed = 0;
-UINT32 totalMemIns = 0; // instruction having atleast one memory operands
-
-INT32 maxImmediate = -INT_MAX;
-INT32 minImmediate = INT_MAX;
-
-ADDRDELTA minDisp = INT_MAX;
-ADDRDELTA maxDisp = -INT_MAX;
+BlockBitmap unqiue_data;        // union of the per-thread data footprints, built at exit
+BlockBitmap unique_ins;         // instruction lines are shared code, so one set for all threads
+
+// Approximate footprint mode: whole-window and per-interval sketches replace the bitmaps
+BOOL approxFootprint = false;
+HyperLogLog insSketch, dataSketch;
+HyperLogLog intervalInsSketch, intervalDataSketch;
+UINT64 footprintInterval = 0;
+UINT64 nextFootprintInterval = 0;
+UINT32 footprintEpoch = 1;
+vector<double> intervalInsFootprint;
+vector<double> intervalDataFootprint;
+
+enum OutputFormat {
+    format_text,
+    format_json,
+    format_csv
+};
+
+static vector<string> format_names = {"text", "json", "csv"};
+UINT32 outputFormat = format_text;
+
+// Simulation point mode: basic block vectors over the whole run instead of the analysis window
+UINT64 simpointInterval = 0;
+UINT64 simpointIntervalStart = 0;
+UINT64 nextSimpointInterval = 0;
+PIN_LOCK bbv_lock;
+map<ADDRINT, BbvBlock*> bbvBlocks;
+vector<BbvBlock*> bbvBlockList;
+vector< vector<double> > intervalVectors;   // projected, normalised basic block vector per interval
+vector<UINT64> intervalStarts;              // rt_icount where each interval began
+vector<UINT64> intervalLengths;             // instructions in each interval, the last one may be short
 
 std::ostream* out = &cerr;
 string outputFile;
@@ -90,6 +505,32 @@ KNOB< string > KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool", "o", "", "specify
 
 KNOB< INT64 > KnobFastForwardCount(KNOB_MODE_WRITEONCE, "pintool", "f", "", "specify fast forward amount in multiples of 1 billion");
 
+KNOB< BOOL > KnobApprox(KNOB_MODE_WRITEONCE, "pintool", "approx", "0", "estimate footprints with HyperLogLog sketches instead of exact bitmaps");
+
+KNOB< double > KnobApproxError(KNOB_MODE_WRITEONCE, "pintool", "approx_error", "0.01", "target relative standard error of the approximate footprints");
+
+KNOB< UINT64 > KnobFootprintInterval(KNOB_MODE_WRITEONCE, "pintool", "footprint_interval", "0", "instructions per footprint interval in approximate mode, 0 disables");
+
+KNOB< string > KnobFormat(KNOB_MODE_WRITEONCE, "pintool", "format", "text", "output format: text, json or csv");
+
+KNOB< UINT64 > KnobSimpointInterval(KNOB_MODE_WRITEONCE, "pintool", "simpoint_interval", "0",
+                                    "profile the whole run into basic block vectors of this many million instructions and emit simulation points, 0 disables");
+
+KNOB< UINT32 > KnobSimpointMaxK(KNOB_MODE_WRITEONCE, "pintool", "simpoint_max_k", "10", "largest number of clusters tried for simulation points");
+
+KNOB< string > KnobSimpointOut(KNOB_MODE_WRITEONCE, "pintool", "simpoint_out", "simpoints", "prefix of the .simpoints and .weights files");
+
+KNOB< string > KnobCpiConfig(KNOB_MODE_WRITEONCE, "pintool", "cpi_config", "",
+                             "CPI model file of 'name cycles' lines: a category name, memory, cache_hit or cache_miss");
+
+KNOB< string > KnobCache(KNOB_MODE_WRITEONCE, "pintool", "cache", "",
+                         "data cache for the CPI model as size:ways:line in bytes, empty disables");
+
+KNOB< UINT64 > KnobCpiInterval(KNOB_MODE_WRITEONCE, "pintool", "cpi_interval", "0", "analysed instructions per CPI interval, 0 disables");
+
+KNOB< UINT32 > KnobTopRoutines(KNOB_MODE_WRITEONCE, "pintool", "top_routines", "0",
+                               "report ISA extension and vector width use of this many hottest routines, 0 disables");
+
 /* ===================================================================== */
 // Utilities
 /* ===================================================================== */
@@ -108,12 +549,76 @@ INT32 Usage()
     return -1;
 }
 
-template<typename T> 
+template<typename T>
 inline void printElement(T t)
 {
     *out << left << setw(30) << t;
 }
 
+/*!
+ *  Read per-category latencies from a CPI model file, false on a malformed line.
+ *  Names not given in the file keep their defaults.
+ */
+BOOL LoadCpiModel(const string& file)
+{
+    ifstream in(file.c_str());
+    if (!in)
+        return false;
+
+    string line;
+    while (std::getline(in, line)) {
+        line = line.substr(0, line.find('#'));
+        stringstream ss(line);
+        string name;
+        double cycles;
+        if (!(ss >> name))
+            continue;
+        if (!(ss >> cycles) || cycles < 0) {
+            cerr << "Bad CPI model line: " << line << endl;
+            return false;
+        }
+
+        if (name == "memory")
+            cpiModel.memoryLatency = cycles;
+        else if (name == "cache_hit")
+            cpiModel.hitLatency = cycles;
+        else if (name == "cache_miss")
+            cpiModel.missLatency = cycles;
+        else {
+            UINT32 i = find(category_names.begin(), category_names.end(), name) - category_names.begin();
+            if (i == category_count) {
+                cerr << "Unknown CPI model entry: " << name << endl;
+                return false;
+            }
+            cpiModel.latency[i] = cycles;
+        }
+    }
+    return true;
+}
+
+// Cycles the CPI model charges for a set of statistics
+double ModelCycles(const InsStats& s)
+{
+    double cycles = 0;
+    for (UINT32 i = 0; i < category_count; i++)
+        cycles += s.categories[i] * cpiModel.latency[i];
+
+    if (cacheProto.Enabled())
+        cycles += s.cacheHits * cpiModel.hitLatency + s.cacheMisses * cpiModel.missLatency;
+    else
+        cycles += (s.categories[cat_loads] + s.categories[cat_stores]) * cpiModel.memoryLatency;
+    return cycles;
+}
+
+// Fixed pseudo-random projection weight in [-1, 1] for block id along dimension d
+static double Projection(UINT64 id, UINT32 d) {
+    UINT64 z = (id * SIMPOINT_DIMS + d + 1) * 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return (z >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+}
+
 /* ===================================================================== */
 // Analysis routines
 /* ===================================================================== */
@@ -125,166 +630,464 @@ inline void printElement(T t)
  * @note use atomic operations for multi-threaded applications
  */
 
+static inline ThreadStats* GetThreadStats(THREADID tid) {
+    return static_cast<ThreadStats*>(PIN_GetThreadData(tls_key, tid));
+}
+
+static inline UINT64* StatCounter(ThreadStats* t, UINT32 offset) {
+    return (UINT64*)((UINT8*)&t->stats + offset);
+}
+
 // Predicated
-VOID IncCategoryCounter(UINT32* count){
-    (*count) ++;
+VOID IncCategoryCounter(THREADID tid, UINT32 offset, UINT32 extensionOffset, UINT32 widthOffset){
+    ThreadStats* t = GetThreadStats(tid);
+    (*StatCounter(t, offset)) ++;
+    (*StatCounter(t, extensionOffset)) ++;
+    (*StatCounter(t, widthOffset)) ++;
+}
+
+inline VOID FootprintIns(UINT64 block) {
+    if (approxFootprint) {
+        insSketch.Insert(block);
+        if (footprintInterval)
+            intervalInsSketch.Insert(block);
+    }
+    else {
+        unique_ins.Insert(block);
+    }
+}
+
+inline VOID FootprintData(ThreadStats* t, UINT64 block) {
+    if (approxFootprint) {
+        dataSketch.Insert(block);
+        if (footprintInterval)
+            intervalDataSketch.Insert(block);
+    }
+    else {
+        t->dataFootprint.Insert(block);
+    }
+}
+
+// Record the footprints of the interval that just ended and start new sketches.
+// Moving to a new epoch makes every block re-add its instruction lines.
+// Called with footprint_lock held.
+VOID CloseFootprintInterval() {
+    intervalInsFootprint.push_back(intervalInsSketch.Estimate());
+    intervalDataFootprint.push_back(intervalDataSketch.Estimate());
+    intervalInsSketch.Clear();
+    intervalDataSketch.Clear();
+    footprintEpoch++;
+    nextFootprintInterval += footprintInterval;
 }
 
 // Predicated
-VOID MemoryAnalysis(UINT32* catAddr, UINT32 numLoadsStores, UINT32 rwSize, VOID* addr, ADDRINT disp){
-    *(catAddr) += numLoadsStores;
+VOID MemoryAnalysis(THREADID tid, UINT32 catOffset, UINT32 numLoadsStores, UINT32 rwSize, VOID* addr, ADDRINT disp){
+    ThreadStats* t = GetThreadStats(tid);
+    *StatCounter(t, catOffset) += numLoadsStores;
     
     // JAYA
     // data footprint
-    UINT32 addri = (UINT32)(addr);
-    
-    UINT32 start = (addri>>5);
-    UINT32 end = ((addri+rwSize) >> 5);
+    ADDRINT addri = (ADDRINT)(addr);
+
+    UINT64 start = (addri>>5);
+    UINT64 end = ((addri+rwSize) >> 5);
 
-    for(UINT32 i = start; i<=end; i++) {
-        unqiue_data.insert(i);
+    for(UINT64 i = start; i<=end; i++) {
+        FootprintData(t, i);
     }
 
+    if (t->cache.Enabled())
+        t->cache.Access(addri, rwSize, t->stats.cacheHits, t->stats.cacheMisses);
+
     ADDRDELTA displacement = (ADDRDELTA)(disp);
-    if(displacement > maxDisp)
-        maxDisp = displacement;
+    if(displacement > t->stats.maxDisp)
+        t->stats.maxDisp = displacement;
 
-    if(displacement < minDisp) 
-        minDisp = displacement;
+    if(displacement < t->stats.minDisp)
+        t->stats.minDisp = displacement;
 }
 
 // Predicated
-VOID MemoryOperandCount(UINT32 loadOps, UINT32 storeOps, UINT32 totalBytesAccessed) {
-    readMemOpsCount[loadOps] += 1;
-    writeMemOpsCount[storeOps] += 1;
-    memOpsCount[loadOps+storeOps] += 1;
+VOID MemoryOperandCount(THREADID tid, UINT32 loadOps, UINT32 storeOps, UINT32 totalBytesAccessed) {
+    InsStats& stats = GetThreadStats(tid)->stats;
+    stats.readMemOpsCount[loadOps] += 1;
+    stats.writeMemOpsCount[storeOps] += 1;
+    stats.memOpsCount[loadOps+storeOps] += 1;
 
     if(loadOps+storeOps){
-        avgBytesAccessed += totalBytesAccessed;
-        if(totalBytesAccessed > maxBytesAccessed){
-            maxBytesAccessed = totalBytesAccessed;
+        stats.bytesAccessed += totalBytesAccessed;
+        if(totalBytesAccessed > stats.maxBytesAccessed){
+            stats.maxBytesAccessed = totalBytesAccessed;
         }
 
-        totalMemIns += 1;  // instruction having atleast one memory operands
+        stats.totalMemIns += 1;  // instruction having atleast one memory operands
     }
 }
 
+/*!
+ * Close the current CPI interval from the sum of every thread's counters.
+ * Other threads keep counting while their shards are read, so an interval
+ * can be off by the blocks in flight at the boundary. Called with
+ * stats_lock held.
+ */
+VOID CloseCpiInterval() {
+    InsStats total;
+    for (UINT32 i = 0; i < threadStats.size(); i++)
+        total.Merge(threadStats[i]->stats);
+
+    UINT64 ins = total.TotalCategoryCount();
+    double cycles = ModelCycles(total);
+    if (ins > prevIntervalIns)
+        intervalCpi.push_back((cycles - prevIntervalCycles) / (ins - prevIntervalIns));
+
+    prevIntervalIns = ins;
+    prevIntervalCycles = cycles;
+    nextCpiInterval += cpiInterval;
+}
+
 // Non Predicated
-void InstructionAnalysis(VOID* ip, UINT32 insSize, UINT32 numOperands, UINT32 regReadCount, UINT32 regWriteCount) {
+VOID ApplyBblDelta(THREADID tid, BblDelta* delta) {
+    ThreadStats* t = GetThreadStats(tid);
+    InsStats& stats = t->stats;
+    for (UINT32 i = 0; i < delta->counters.size(); i++)
+        *StatCounter(t, delta->counters[i].first) += delta->counters[i].second;
+
+    stats.bytesAccessed += delta->bytesAccessed;
+
+    if (delta->maxImmediate > stats.maxImmediate)
+        stats.maxImmediate = delta->maxImmediate;
+    if (delta->minImmediate < stats.minImmediate)
+        stats.minImmediate = delta->minImmediate;
+    if (delta->maxBytesAccessed > stats.maxBytesAccessed)
+        stats.maxBytesAccessed = delta->maxBytesAccessed;
+
+    if (delta->routine) {
+        __sync_fetch_and_add(&delta->routine->ins, delta->numIns);
+        for (UINT32 i = 0; i < delta->routineCounts.size(); i++)
+            __sync_fetch_and_add(&delta->routine->counts[delta->routineCounts[i].first], delta->routineCounts[i].second);
+    }
 
-    analysedInsCount ++;
-    
-    // JAYA
-    // instruction footprint
-    UINT32 ipa = (UINT32)(ip);
-    
-    UINT32 start = (ipa>>5);
-    UINT32 end = ((ipa+insSize) >> 5);
+    UINT64 analysed = __sync_add_and_fetch(&analysedInsCount, delta->numIns);
 
-    for(UINT32 i = start; i<=end; i++) {
-        unique_ins.insert(i);
+    if (cpiInterval && analysed >= nextCpiInterval) {
+        PIN_GetLock(&stats_lock, tid + 1);
+        if (analysedInsCount >= nextCpiInterval)
+            CloseCpiInterval();
+        PIN_ReleaseLock(&stats_lock);
     }
 
-    insLenCount[insSize] += 1;
-    numOperandsCount[numOperands] += 1;
-    regReadOperandsCount[regReadCount] += 1;
-    regWriteOperandsCount[regWriteCount] += 1;
+    if (footprintInterval && analysed >= nextFootprintInterval) {
+        PIN_GetLock(&footprint_lock, tid + 1);
+        if (analysedInsCount >= nextFootprintInterval)
+            CloseFootprintInterval();
+        PIN_ReleaseLock(&footprint_lock);
+    }
+
+    if (delta->seenEpoch == footprintEpoch)
+        return;
+
+    // instruction footprint, added once per epoch by whichever thread gets there first
+    PIN_GetLock(&footprint_lock, tid + 1);
+    if (delta->seenEpoch != footprintEpoch) {
+        delta->seenEpoch = footprintEpoch;
+        for (UINT32 i = 0; i < delta->insBlocks.size(); i++)
+            FootprintIns(delta->insBlocks[i]);
+    }
+    PIN_ReleaseLock(&footprint_lock);
+}
+
+/*!
+ * Close the current simulation point interval: project its basic block
+ * vector to SIMPOINT_DIMS dimensions and reset the block counts. Blocks
+ * counted by other threads while the vector is read land in either
+ * interval.
+ */
+VOID CloseBbvInterval(BOOL final) {
+    PIN_GetLock(&bbv_lock, PIN_ThreadId() + 1);
+
+    UINT64 now = rt_icount;
+    if ((!final && now < nextSimpointInterval) || now <= simpointIntervalStart) {
+        PIN_ReleaseLock(&bbv_lock);
+        return;
+    }
+
+    UINT64 start = simpointIntervalStart;
+    UINT64 instrs = now - start;
+    simpointIntervalStart = now;
+    nextSimpointInterval = now + simpointInterval;
+
+    vector<double> v(SIMPOINT_DIMS, 0);
+    for (UINT32 i = 0; i < bbvBlockList.size(); i++) {
+        UINT64 count = bbvBlockList[i]->count;
+        if (count == 0)
+            continue;
+        double weight = (double)count / instrs;
+        for (UINT32 d = 0; d < SIMPOINT_DIMS; d++)
+            v[d] += weight * Projection(bbvBlockList[i]->id, d);
+        bbvBlockList[i]->count = 0;
+    }
+    intervalVectors.push_back(v);
+    intervalStarts.push_back(start);
+    intervalLengths.push_back(instrs);
+
+    PIN_ReleaseLock(&bbv_lock);
 }
 
 // Non Predicated
-VOID ImmediateCount(INT32 immediate) {
-    if(immediate > maxImmediate) {
-        maxImmediate = immediate;
+VOID BbvCount(BbvBlock* block, UINT32 numInstInBbl) {
+    __sync_fetch_and_add(&block->count, numInstInBbl);
+    if (__sync_add_and_fetch(&rt_icount, numInstInBbl) >= nextSimpointInterval)
+        CloseBbvInterval(false);
+}
+
+static double Distance(const vector<double>& a, const vector<double>& b) {
+    double dist = 0;
+    for (UINT32 d = 0; d < a.size(); d++)
+        dist += (a[d] - b[d]) * (a[d] - b[d]);
+    return dist;
+}
+
+/*!
+ * Lloyd's k-means over the interval vectors, seeded k-means++ style from
+ * a fixed generator so runs are repeatable. Returns the total squared
+ * distance of the points to their centroids.
+ */
+static double KMeans(UINT32 k, UINT64 seed, vector<UINT32>& assignment, vector< vector<double> >& centroids) {
+    const vector< vector<double> >& points = intervalVectors;
+    UINT32 n = points.size();
+
+    // k-means++ seeding
+    UINT32 first = (UINT32)((Projection(seed, 0) * 0.5 + 0.5) * n);
+    centroids.assign(1, points[min(first, n - 1)]);
+    vector<double> nearest(n);
+    for (UINT32 c = 1; c < k; c++) {
+        double total = 0;
+        for (UINT32 i = 0; i < n; i++) {
+            nearest[i] = Distance(points[i], centroids[0]);
+            for (UINT32 j = 1; j < centroids.size(); j++)
+                nearest[i] = min(nearest[i], Distance(points[i], centroids[j]));
+            total += nearest[i];
+        }
+        double target = (Projection(seed, c) * 0.5 + 0.5) * total;
+        UINT32 pick = 0;
+        while (pick + 1 < n && target > nearest[pick]) {
+            target -= nearest[pick];
+            pick++;
+        }
+        centroids.push_back(points[pick]);
+    }
+
+    assignment.assign(n, 0);
+    double distortion = 0;
+    for (UINT32 iter = 0; iter < SIMPOINT_ITERATIONS; iter++) {
+        BOOL changed = (iter == 0);
+        distortion = 0;
+        for (UINT32 i = 0; i < n; i++) {
+            UINT32 best = 0;
+            double best_dist = Distance(points[i], centroids[0]);
+            for (UINT32 c = 1; c < k; c++) {
+                double dist = Distance(points[i], centroids[c]);
+                if (dist < best_dist) {
+                    best = c;
+                    best_dist = dist;
+                }
+            }
+            changed |= (assignment[i] != best);
+            assignment[i] = best;
+            distortion += best_dist;
+        }
+        if (!changed)
+            break;
+
+        vector<UINT32> members(k, 0);
+        vector< vector<double> > sums(k, vector<double>(SIMPOINT_DIMS, 0));
+        for (UINT32 i = 0; i < n; i++) {
+            members[assignment[i]]++;
+            for (UINT32 d = 0; d < SIMPOINT_DIMS; d++)
+                sums[assignment[i]][d] += points[i][d];
+        }
+        for (UINT32 c = 0; c < k; c++) {
+            if (members[c] == 0)
+                continue;   // an empty cluster keeps its old centroid
+            for (UINT32 d = 0; d < SIMPOINT_DIMS; d++)
+                centroids[c][d] = sums[c][d] / members[c];
+        }
     }
+    return distortion;
+}
 
-    if(immediate < minImmediate) {
-        minImmediate = immediate;
+// Bayesian information criterion of a clustering under a spherical Gaussian model, higher is better
+static double Bic(UINT32 k, const vector<UINT32>& assignment, double distortion) {
+    double r = assignment.size();
+    double m = SIMPOINT_DIMS;
+    if (r <= k)
+        return 0;
+
+    double variance = max(distortion / (m * (r - k)), 1e-12);
+    vector<UINT32> members(k, 0);
+    for (UINT32 i = 0; i < assignment.size(); i++)
+        members[assignment[i]]++;
+
+    double likelihood = 0;
+    for (UINT32 c = 0; c < k; c++) {
+        double rc = members[c];
+        if (rc == 0)
+            continue;
+        likelihood += rc * log(rc) - rc * log(r) - rc * m / 2 * log(2 * M_PI * variance) - (rc - 1) * m / 2;
     }
+    double params = (k - 1) + m * k + 1;
+    return likelihood - params / 2 * log(r);
 }
 
-// VOID CountIns(UINT32 numInstInBbl)
-// {
-//     insCount += numInstInBbl;
-// }
+/*!
+ * Cluster the interval vectors for every k up to -simpoint_max_k, keep the
+ * smallest k whose BIC comes within SIMPOINT_BIC_FRACTION of the best,
+ * and write one simulation point per cluster (the interval nearest its
+ * centroid) with the cluster's share of executed instructions as weight.
+ * Intervals close on the first block past each boundary, so the printed
+ * start and length are the interval's own; pass them to HW2/HW4 as
+ * -ff_instrs and -window_len to simulate the point.
+ */
+VOID WriteSimPoints() {
+    CloseBbvInterval(true);
+
+    UINT32 n = intervalVectors.size();
+    if (n == 0)
+        return;
+    // Every k must leave fewer clusters than intervals for the BIC to be defined
+    UINT32 max_k = max(min(n - 1, KnobSimpointMaxK.Value()), 1U);
+
+    vector< vector<UINT32> > assignments(max_k + 1);
+    vector< vector< vector<double> > > centroids(max_k + 1);
+    vector<double> bic(max_k + 1, 0);
+    for (UINT32 k = 1; k <= max_k; k++) {
+        double best = -1;
+        for (UINT32 seed = 0; seed < SIMPOINT_SEEDS; seed++) {
+            vector<UINT32> assignment;
+            vector< vector<double> > centres;
+            double distortion = KMeans(k, k * SIMPOINT_SEEDS + seed, assignment, centres);
+            if (best < 0 || distortion < best) {
+                best = distortion;
+                assignments[k] = assignment;
+                centroids[k] = centres;
+            }
+        }
+        bic[k] = Bic(k, assignments[k], best);
+    }
 
-// Non Predicated
-VOID CountIns()
-{
-    insCount ++;
+    double lo = *min_element(bic.begin() + 1, bic.end());
+    double hi = *max_element(bic.begin() + 1, bic.end());
+    UINT32 k = 1;
+    while (k < max_k && bic[k] < lo + SIMPOINT_BIC_FRACTION * (hi - lo))
+        k++;
+
+    UINT64 total = 0;
+    for (UINT32 i = 0; i < n; i++)
+        total += intervalLengths[i];
+
+    string prefix = KnobSimpointOut.Value();
+    ofstream points((prefix + ".simpoints").c_str());
+    ofstream weights((prefix + ".weights").c_str());
+
+    printElement("Simulation Points"); *out << endl;
+    printElement("Intervals: "); printElement(n); *out << endl;
+    printElement("Clusters: "); printElement(k); *out << endl;
+    printElement("|"); printElement("Cluster"); printElement("|"); printElement("Interval"); printElement("|"); printElement("Start Instruction"); printElement("|"); printElement("Length"); printElement("|"); printElement("Weight"); printElement("|"); *out << endl;
+
+    const vector<UINT32>& assignment = assignments[k];
+    for (UINT32 c = 0; c < k; c++) {
+        INT32 pick = -1;
+        double pick_dist = 0;
+        UINT64 instrs = 0;
+        for (UINT32 i = 0; i < n; i++) {
+            if (assignment[i] != c)
+                continue;
+            instrs += intervalLengths[i];
+            double dist = Distance(intervalVectors[i], centroids[k][c]);
+            if (pick < 0 || dist < pick_dist) {
+                pick = i;
+                pick_dist = dist;
+            }
+        }
+        if (pick < 0)
+            continue;
+
+        double weight = (double)instrs / total;
+        points << pick << " " << c << endl;
+        weights << weight << " " << c << endl;
+
+        printElement("|"); printElement(c); printElement("|"); printElement(pick); printElement("|"); printElement(intervalStarts[pick]); printElement("|"); printElement(intervalLengths[pick]); printElement("|"); printElement(weight); printElement("|"); *out << endl;
+    }
 }
 
-// Terminate condition
-ADDRINT Terminate(void)
-{
-    return (insCount >= fastForwardCount + ONE_BILLION);
+// SIMD instructions of a routine that operate on more than one element
+static UINT64 PackedCount(const RoutineStats* r) {
+    UINT64 packed = 0;
+    for (UINT32 w = width_64; w < width_count; w++)
+        packed += r->counts[extension_count + w];
+    return packed;
 }
 
-// Analysis routine to check fast-forward condition
-ADDRINT FastForward (void) {
-	return ((insCount >= fastForwardCount) && insCount);
+static BOOL HotterRoutine(const RoutineStats* a, const RoutineStats* b) {
+    return a->ins > b->ins;
 }
 
-// Analysis routine to exit the application
-void MyExitRoutine (void) {
-	// Do an exit system call to exit the application.
-	// As we are calling the exit system call PIN would not be able to instrument application end.
-	// Because of this, even if you are instrumenting the application end, the Fini function would not
-	// be called. Thus you should report the statistics here, before doing the exit system call.
+// The -top_routines routines with the most executed instructions
+static vector<RoutineStats*> HotRoutines() {
+    vector<RoutineStats*> hot;
+    for (map<ADDRINT, RoutineStats*>::const_iterator it = routines.begin(); it != routines.end(); ++it)
+        hot.push_back(it->second);
+    sort(hot.begin(), hot.end(), HotterRoutine);
+    if (hot.size() > topRoutines)
+        hot.resize(topRoutines);
+    return hot;
+}
 
-    // Print the stats here and then exit
-    printElement("Total Ins Count: "); printElement(insCount); *out << "\n";
+// Human-readable report, one printElement table per statistic
+VOID PrintText(const InsStats& s, UINT64 insCategoryTotalCount, INT64 elapsed_time_s) {
+    printElement("Total Ins Count: "); printElement(rt_icount); *out << "\n";
     printElement("Analysed Ins Count: "); printElement(analysedInsCount); *out<< "\n";
     *out << endl;
     *out << endl;
 
-    // Calculate total ins executed
-    insCategoryTotalCount = (insCategoryCount.loads) +
-                            (insCategoryCount.stores) +
-                            (insCategoryCount.nop) +
-                            (insCategoryCount.directCall) +
-                            (insCategoryCount.indirectCall) +
-                            (insCategoryCount.returns) +
-                            (insCategoryCount.unconditionalBranch) +
-                            (insCategoryCount.conditionalBranch) +
-                            (insCategoryCount.logicalOps) +
-                            (insCategoryCount.rotateAndShift) +
-                            (insCategoryCount.flagOps) +
-                            (insCategoryCount.vectorIns) +
-                            (insCategoryCount.conditionalMoves) +
-                            (insCategoryCount.mmxSSEIns) +
-                            (insCategoryCount.syscalls) +
-                            (insCategoryCount.fpIns) +
-                            (insCategoryCount.others);
-
     // Print category stats in a file
     printElement("Category"); printElement("InsCount"); printElement("Percentage"); *out << endl;
-    printElement("Loads"); printElement(insCategoryCount.loads); printElement((insCategoryCount.loads/(float)insCategoryTotalCount) * 100.0); *out << endl;
-    printElement("Stores"); printElement(insCategoryCount.stores); printElement((insCategoryCount.stores/(float)insCategoryTotalCount) * 100.0); *out << endl;
-    printElement("Nop"); printElement(insCategoryCount.nop); printElement((insCategoryCount.nop/(float)insCategoryTotalCount) * 100.0); *out << endl;
-    printElement("DirectCall"); printElement(insCategoryCount.directCall); printElement((insCategoryCount.directCall/(float)insCategoryTotalCount) * 100.0); *out << endl;
-    printElement("IndirectCall"); printElement(insCategoryCount.indirectCall); printElement((insCategoryCount.indirectCall/(float)insCategoryTotalCount) * 100.0); *out << endl;
-    printElement("Returns"); printElement(insCategoryCount.returns); printElement((insCategoryCount.returns/(float)insCategoryTotalCount) * 100.0); *out << endl;
-    printElement("UnconditionalBranch"); printElement(insCategoryCount.unconditionalBranch); printElement((insCategoryCount.unconditionalBranch/(float)insCategoryTotalCount) * 100.0); *out << endl;
-    printElement("ConditionalBranch"); printElement(insCategoryCount.conditionalBranch); printElement((insCategoryCount.conditionalBranch/(float)insCategoryTotalCount) * 100.0); *out << endl;
-    printElement("LogicalOps"); printElement(insCategoryCount.logicalOps); printElement((insCategoryCount.logicalOps/(float)insCategoryTotalCount) * 100.0); *out << endl;
-    printElement("RotateAndShift"); printElement(insCategoryCount.rotateAndShift); printElement((insCategoryCount.rotateAndShift/(float)insCategoryTotalCount) * 100.0); *out << endl;
-    printElement("FlagOps"); printElement(insCategoryCount.flagOps); printElement((insCategoryCount.flagOps/(float)insCategoryTotalCount) * 100.0); *out << endl;
-    printElement("VectorIns"); printElement(insCategoryCount.vectorIns); printElement((insCategoryCount.vectorIns/(float)insCategoryTotalCount) * 100.0); *out << endl;
-    printElement("ConditionalMoves"); printElement(insCategoryCount.conditionalMoves); printElement((insCategoryCount.conditionalMoves/(float)insCategoryTotalCount) * 100.0); *out << endl;
-    printElement("MmxSSEIns"); printElement(insCategoryCount.mmxSSEIns); printElement((insCategoryCount.mmxSSEIns/(float)insCategoryTotalCount) * 100.0); *out << endl;
-    printElement("Syscalls"); printElement(insCategoryCount.syscalls); printElement((insCategoryCount.syscalls/(float)insCategoryTotalCount) * 100.0); *out << endl;
-    printElement("FpIns"); printElement(insCategoryCount.fpIns); printElement((insCategoryCount.fpIns/(float)insCategoryTotalCount) * 100.0); *out << endl;
-    printElement("Others"); printElement(insCategoryCount.others); printElement((insCategoryCount.others/(float)insCategoryTotalCount) * 100.0); *out << endl;
+    for (UINT32 i = 0; i < category_count; i++) {
+        printElement(category_names[i]); printElement(s.categories[i]); printElement((s.categories[i]/(float)insCategoryTotalCount) * 100.0); *out << endl;
+    }
     *out << endl;
     printElement("Total Ins"); printElement(insCategoryTotalCount); *out << endl;
     
     *out << endl;
-    CPI = ceil(((insCategoryCount.loads + insCategoryCount.stores) * 69.0 + (insCategoryTotalCount))/ insCategoryTotalCount);
     printElement("CPI: "); printElement(CPI); *out << endl;
+    if (cacheProto.Enabled()) {
+        printElement("Data Cache Hits: "); printElement(s.cacheHits); *out << endl;
+        printElement("Data Cache Misses: "); printElement(s.cacheMisses); *out << endl;
+        printElement("Data Cache Miss Rate (%): "); printElement((s.cacheMisses * 100.0) / (s.cacheHits + s.cacheMisses)); *out << endl;
+    }
+    if (!intervalCpi.empty()) {
+        printElement("|"); printElement("Interval"); printElement("|"); printElement("CPI"); printElement("|"); *out << endl;
+        for(unsigned int i=0; i<intervalCpi.size(); i++) {
+            printElement("|"); printElement(i); printElement("|"); printElement(intervalCpi[i]); printElement("|"); *out << endl;
+        }
+    }
 
     printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
-    printElement("Instruction Footprint: "); printElement(unique_ins.size()); *out << endl;
-    printElement("Data Footprint: "); printElement(unqiue_data.size()); *out << endl;
+    if (approxFootprint) {
+        printElement("Instruction Footprint (approx): "); printElement((UINT64)insSketch.Estimate()); *out << endl;
+        printElement("Data Footprint (approx): "); printElement((UINT64)dataSketch.Estimate()); *out << endl;
+
+        if (footprintInterval) {
+            printElement("|"); printElement("Interval"); printElement("|"); printElement("Ins Footprint"); printElement("|"); printElement("Data Footprint"); printElement("|"); *out << endl;
+            for(unsigned int i=0; i<intervalInsFootprint.size(); i++) {
+                printElement("|"); printElement(i); printElement("|"); printElement((UINT64)intervalInsFootprint[i]); printElement("|"); printElement((UINT64)intervalDataFootprint[i]); printElement("|"); *out << endl;
+            }
+        }
+    }
+    else {
+        printElement("Instruction Footprint: "); printElement(unique_ins.size()); *out << endl;
+        printElement("Data Footprint: "); printElement(unqiue_data.size()); *out << endl;
+    }
 
     printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
     printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
@@ -292,81 +1095,360 @@ void MyExitRoutine (void) {
     printElement("Distribution of instruction length"); *out<<endl;
     printElement("|"); printElement("Instruction Length"); printElement("|"); printElement("Num Ins"); printElement("|"); *out<<endl;
     printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
-    for(unsigned int i=0; i<insLenCount.size(); i++) {
-        printElement("|"); printElement(i); printElement("|"); printElement(insLenCount[i]); printElement("|"); *out<<endl;
+    for(unsigned int i=0; i<INS_LEN_BUCKETS; i++) {
+        printElement("|"); printElement(i); printElement("|"); printElement(s.insLenCount[i]); printElement("|"); *out<<endl;
     }
     printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
 
     printElement("Distribution of the number of operands in an instruction"); *out<<endl;
     printElement("|"); printElement("Num Operands"); printElement("|"); printElement("Num Ins"); printElement("|"); *out<<endl;
     printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
-    for(unsigned int i=0; i<numOperandsCount.size(); i++) {
-        printElement("|"); printElement(i); printElement("|"); printElement(numOperandsCount[i]); printElement("|"); *out<<endl;
+    for(unsigned int i=0; i<OPERAND_BUCKETS; i++) {
+        printElement("|"); printElement(i); printElement("|"); printElement(s.numOperandsCount[i]); printElement("|"); *out<<endl;
     }
     printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
 
     printElement("Distribution of the number of register read operands in an instruction"); *out<<endl;
     printElement("|"); printElement("Num REG Read Ops"); printElement("|"); printElement("Num Ins"); printElement("|"); *out<<endl;
     printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
-    for(unsigned int i=0; i<regReadOperandsCount.size(); i++) {
-        printElement("|"); printElement(i); printElement("|"); printElement(regReadOperandsCount[i]); printElement("|"); *out<<endl;
+    for(unsigned int i=0; i<OPERAND_BUCKETS; i++) {
+        printElement("|"); printElement(i); printElement("|"); printElement(s.regReadOperandsCount[i]); printElement("|"); *out<<endl;
     }
     printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
 
     printElement("Distribution of the number of register write operands in an instruction"); *out<<endl;
     printElement("|"); printElement("Num REG Write Ops"); printElement("|"); printElement("Num Ins"); printElement("|"); *out<<endl;
     printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
-    for(unsigned int i=0; i<regWriteOperandsCount.size(); i++) {
-        printElement("|"); printElement(i); printElement("|"); printElement(regWriteOperandsCount[i]); printElement("|"); *out<<endl;
+    for(unsigned int i=0; i<OPERAND_BUCKETS; i++) {
+        printElement("|"); printElement(i); printElement("|"); printElement(s.regWriteOperandsCount[i]); printElement("|"); *out<<endl;
     }
     printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
 
     printElement("Distribution of the number of memory operands in an instruction"); *out<<endl;
     printElement("|"); printElement("Num Memory Ops"); printElement("|"); printElement("Num Ins"); printElement("|"); *out<<endl;
     printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
-    for(unsigned int i=0; i<memOpsCount.size(); i++) {
-        printElement("|"); printElement(i); printElement("|"); printElement(memOpsCount[i]); printElement("|"); *out<<endl;
+    for(unsigned int i=0; i<OPERAND_BUCKETS; i++) {
+        printElement("|"); printElement(i); printElement("|"); printElement(s.memOpsCount[i]); printElement("|"); *out<<endl;
     }
     printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
     
     printElement("Distribution of the number of memory read operands in an instruction"); *out<<endl;
     printElement("|"); printElement("Num Memory Read Ops"); printElement("|"); printElement("Num Ins"); printElement("|"); *out<<endl;
     printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
-    for(unsigned int i=0; i<readMemOpsCount.size(); i++) {
-        printElement("|"); printElement(i); printElement("|"); printElement(readMemOpsCount[i]); printElement("|"); *out<<endl;
+    for(unsigned int i=0; i<OPERAND_BUCKETS; i++) {
+        printElement("|"); printElement(i); printElement("|"); printElement(s.readMemOpsCount[i]); printElement("|"); *out<<endl;
     }
     printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
 
     printElement("Distribution of the number of memory write operands in an instruction"); *out<<endl;
     printElement("|"); printElement("Num Memory Write Ops"); printElement("|"); printElement("Num Ins"); printElement("|"); *out<<endl;
     printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
-    for(unsigned int i=0; i<writeMemOpsCount.size(); i++) {
-        printElement("|"); printElement(i); printElement("|"); printElement(writeMemOpsCount[i]); printElement("|"); *out<<endl;
+    for(unsigned int i=0; i<OPERAND_BUCKETS; i++) {
+        printElement("|"); printElement(i); printElement("|"); printElement(s.writeMemOpsCount[i]); printElement("|"); *out<<endl;
+    }
+    printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
+
+    printElement("Distribution by ISA extension"); *out<<endl;
+    printElement("|"); printElement("Extension"); printElement("|"); printElement("Num Ins"); printElement("|"); *out<<endl;
+    printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
+    for(unsigned int i=0; i<extension_count; i++) {
+        printElement("|"); printElement(extension_names[i]); printElement("|"); printElement(s.extensions[i]); printElement("|"); *out<<endl;
+    }
+    printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
+
+    printElement("Distribution by vector width"); *out<<endl;
+    printElement("|"); printElement("Width (bits)"); printElement("|"); printElement("Num Ins"); printElement("|"); *out<<endl;
+    printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
+    for(unsigned int i=0; i<width_count; i++) {
+        printElement("|"); printElement(width_names[i]); printElement("|"); printElement(s.vectorWidths[i]); printElement("|"); *out<<endl;
     }
     printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
 
+    if (topRoutines) {
+        vector<RoutineStats*> hot = HotRoutines();
+        printElement("Hottest routines"); *out<<endl;
+        printElement("|"); printElement("Routine"); printElement("|"); printElement("Num Ins"); printElement("|"); printElement("SIMD Scalar");
+        printElement("|"); printElement("SIMD Packed"); printElement("|"); printElement("Vectorised (%)"); printElement("|"); printElement("Top Extension"); printElement("|"); *out<<endl;
+        printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
+        for(unsigned int i=0; i<hot.size(); i++) {
+            const RoutineStats* r = hot[i];
+            UINT64 scalar = r->counts[extension_count + width_scalar];
+            UINT64 packed = PackedCount(r);
+            UINT32 top = 0;
+            for (UINT32 e = 1; e < extension_count; e++)
+                if (r->counts[e] > r->counts[top])
+                    top = e;
+            printElement("|"); printElement(r->name.substr(0, 29)); printElement("|"); printElement(r->ins); printElement("|"); printElement(scalar);
+            printElement("|"); printElement(packed); printElement("|"); printElement(scalar + packed ? (packed * 100.0) / (scalar + packed) : 0.0);
+            printElement("|"); printElement(extension_names[top]); printElement("|"); *out<<endl;
+        }
+        printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
+    }
+
     printElement("Memory Bytes Touched"); *out << endl;
-    printElement("Maximum: "); printElement(maxBytesAccessed); *out << endl;
-    printElement("Average: "); printElement(avgBytesAccessed/((float)totalMemIns)); *out << endl;
+    printElement("Maximum: "); printElement(s.maxBytesAccessed); *out << endl;
+    printElement("Average: "); printElement(s.bytesAccessed/((float)s.totalMemIns)); *out << endl;
     printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
     
     printElement("Immediate Field value"); *out << endl;
-    printElement("Maximum: "); printElement(maxImmediate); *out << endl;
-    printElement("Minimum: "); printElement(minImmediate); *out << endl;
+    printElement("Maximum: "); printElement(s.maxImmediate); *out << endl;
+    printElement("Minimum: "); printElement(s.minImmediate); *out << endl;
     printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
 
     printElement("Displacement Field Value"); *out << endl;
-    printElement("Maximum: "); printElement(maxDisp); *out << endl;
-    printElement("Minimum: "); printElement(minDisp); *out << endl;
+    printElement("Maximum: "); printElement(s.maxDisp); *out << endl;
+    printElement("Minimum: "); printElement(s.minDisp); *out << endl;
     printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
-    
-    t_end = std::chrono::high_resolution_clock::now();
 
-    auto elapsed_time_s = std::chrono::duration_cast<std::chrono::seconds>(t_end-t_start).count();
     *out << endl;
     *out << endl;
     printElement("Total Execution Time: "); printElement(elapsed_time_s); *out<< endl;
-    
+}
+
+// Prints a histogram as a JSON array
+static VOID PrintJsonArray(const char* name, const UINT64* values, UINT32 buckets, BOOL last = false) {
+    *out << "    \"" << name << "\": [";
+    for (UINT32 i = 0; i < buckets; i++)
+        *out << (i ? ", " : "") << values[i];
+    *out << "]" << (last ? "" : ",") << endl;
+}
+
+// Machine-readable report as a single JSON object
+VOID PrintJson(const InsStats& s, UINT64 insCategoryTotalCount, INT64 elapsed_time_s) {
+    *out << "{" << endl;
+    *out << "  \"total_ins\": " << rt_icount << "," << endl;
+    *out << "  \"analysed_ins\": " << analysedInsCount << "," << endl;
+
+    *out << "  \"categories\": {" << endl;
+    for (UINT32 i = 0; i < category_count; i++)
+        *out << "    \"" << category_names[i] << "\": " << s.categories[i] << (i + 1 < category_count ? "," : "") << endl;
+    *out << "  }," << endl;
+    *out << "  \"total_category_ins\": " << insCategoryTotalCount << "," << endl;
+
+    *out << "  \"extensions\": {";
+    for (UINT32 i = 0; i < extension_count; i++)
+        *out << (i ? ", " : "") << "\"" << extension_names[i] << "\": " << s.extensions[i];
+    *out << "}," << endl;
+    *out << "  \"vector_widths\": {";
+    for (UINT32 i = 0; i < width_count; i++)
+        *out << (i ? ", " : "") << "\"" << width_names[i] << "\": " << s.vectorWidths[i];
+    *out << "}," << endl;
+
+    if (topRoutines) {
+        vector<RoutineStats*> hot = HotRoutines();
+        *out << "  \"routines\": [" << endl;
+        for (UINT32 r = 0; r < hot.size(); r++) {
+            *out << "    {\"name\": \"" << hot[r]->name << "\", \"ins\": " << hot[r]->ins << ", \"extensions\": {";
+            for (UINT32 i = 0; i < extension_count; i++)
+                *out << (i ? ", " : "") << "\"" << extension_names[i] << "\": " << hot[r]->counts[i];
+            *out << "}, \"vector_widths\": {";
+            for (UINT32 i = 0; i < width_count; i++)
+                *out << (i ? ", " : "") << "\"" << width_names[i] << "\": " << hot[r]->counts[extension_count + i];
+            *out << "}}" << (r + 1 < hot.size() ? "," : "") << endl;
+        }
+        *out << "  ]," << endl;
+    }
+    *out << "  \"cpi\": " << CPI << "," << endl;
+    if (cacheProto.Enabled())
+        *out << "  \"cache\": {\"hits\": " << s.cacheHits << ", \"misses\": " << s.cacheMisses << "}," << endl;
+    *out << "  \"cpi_intervals\": [";
+    for (UINT32 i = 0; i < intervalCpi.size(); i++)
+        *out << (i ? ", " : "") << intervalCpi[i];
+    *out << "]," << endl;
+
+    *out << "  \"footprint\": {" << endl;
+    if (approxFootprint) {
+        *out << "    \"approximate\": true," << endl;
+        *out << "    \"instruction\": " << (UINT64)insSketch.Estimate() << "," << endl;
+        *out << "    \"data\": " << (UINT64)dataSketch.Estimate() << "," << endl;
+        *out << "    \"intervals\": [";
+        for (UINT32 i = 0; i < intervalInsFootprint.size(); i++)
+            *out << (i ? ", " : "") << "{\"instruction\": " << (UINT64)intervalInsFootprint[i]
+                 << ", \"data\": " << (UINT64)intervalDataFootprint[i] << "}";
+        *out << "]" << endl;
+    }
+    else {
+        *out << "    \"approximate\": false," << endl;
+        *out << "    \"instruction\": " << unique_ins.size() << "," << endl;
+        *out << "    \"data\": " << unqiue_data.size() << endl;
+    }
+    *out << "  }," << endl;
+
+    *out << "  \"histograms\": {" << endl;
+    PrintJsonArray("instruction_length", s.insLenCount, INS_LEN_BUCKETS);
+    PrintJsonArray("operands", s.numOperandsCount, OPERAND_BUCKETS);
+    PrintJsonArray("register_read_operands", s.regReadOperandsCount, OPERAND_BUCKETS);
+    PrintJsonArray("register_write_operands", s.regWriteOperandsCount, OPERAND_BUCKETS);
+    PrintJsonArray("memory_operands", s.memOpsCount, OPERAND_BUCKETS);
+    PrintJsonArray("memory_read_operands", s.readMemOpsCount, OPERAND_BUCKETS);
+    PrintJsonArray("memory_write_operands", s.writeMemOpsCount, OPERAND_BUCKETS, true);
+    *out << "  }," << endl;
+
+    *out << "  \"memory_bytes_touched\": {\"max\": " << s.maxBytesAccessed
+         << ", \"average\": " << (s.totalMemIns ? s.bytesAccessed / (double)s.totalMemIns : 0.0) << "}," << endl;
+    *out << "  \"immediate\": {\"max\": " << s.maxImmediate << ", \"min\": " << s.minImmediate << "}," << endl;
+    *out << "  \"displacement\": {\"max\": " << s.maxDisp << ", \"min\": " << s.minDisp << "}," << endl;
+    *out << "  \"execution_time_s\": " << elapsed_time_s << "," << endl;
+
+    *out << "  \"threads\": [" << endl;
+    for (UINT32 t = 0; t < threadStats.size(); t++) {
+        const ThreadStats* ts = threadStats[t];
+        *out << "    {\"tid\": " << ts->tid << ", \"categories\": {";
+        for (UINT32 i = 0; i < category_count; i++)
+            *out << (i ? ", " : "") << "\"" << category_names[i] << "\": " << ts->stats.categories[i];
+        *out << "}, \"total_category_ins\": " << ts->stats.TotalCategoryCount();
+        if (!approxFootprint)
+            *out << ", \"data_footprint\": " << ts->dataFootprint.size();
+        *out << "}" << (t + 1 < threadStats.size() ? "," : "") << endl;
+    }
+    *out << "  ]" << endl;
+    *out << "}" << endl;
+}
+
+// Prints a histogram as one CSV row per bucket
+static VOID PrintCsvHistogram(const char* name, const UINT64* values, UINT32 buckets) {
+    for (UINT32 i = 0; i < buckets; i++)
+        *out << name << "," << i << "," << values[i] << endl;
+}
+
+// Machine-readable report as section,key,value rows
+VOID PrintCsv(const InsStats& s, UINT64 insCategoryTotalCount, INT64 elapsed_time_s) {
+    *out << "section,key,value" << endl;
+    *out << "count,total_ins," << rt_icount << endl;
+    *out << "count,analysed_ins," << analysedInsCount << endl;
+
+    for (UINT32 i = 0; i < category_count; i++)
+        *out << "category," << category_names[i] << "," << s.categories[i] << endl;
+    *out << "category,Total," << insCategoryTotalCount << endl;
+    for (UINT32 i = 0; i < extension_count; i++)
+        *out << "extension," << extension_names[i] << "," << s.extensions[i] << endl;
+    for (UINT32 i = 0; i < width_count; i++)
+        *out << "vector_width," << width_names[i] << "," << s.vectorWidths[i] << endl;
+
+    if (topRoutines) {
+        vector<RoutineStats*> hot = HotRoutines();
+        for (UINT32 r = 0; r < hot.size(); r++) {
+            *out << "routine:" << hot[r]->name << ",ins," << hot[r]->ins << endl;
+            for (UINT32 i = 0; i < extension_count; i++)
+                *out << "routine:" << hot[r]->name << ",extension_" << extension_names[i] << "," << hot[r]->counts[i] << endl;
+            for (UINT32 i = 0; i < width_count; i++)
+                *out << "routine:" << hot[r]->name << ",width_" << width_names[i] << "," << hot[r]->counts[extension_count + i] << endl;
+        }
+    }
+    *out << "performance,cpi," << CPI << endl;
+    if (cacheProto.Enabled()) {
+        *out << "performance,cache_hits," << s.cacheHits << endl;
+        *out << "performance,cache_misses," << s.cacheMisses << endl;
+    }
+    for (UINT32 i = 0; i < intervalCpi.size(); i++)
+        *out << "interval_cpi," << i << "," << intervalCpi[i] << endl;
+
+    if (approxFootprint) {
+        *out << "footprint,instruction_approx," << (UINT64)insSketch.Estimate() << endl;
+        *out << "footprint,data_approx," << (UINT64)dataSketch.Estimate() << endl;
+        for (UINT32 i = 0; i < intervalInsFootprint.size(); i++) {
+            *out << "interval_instruction_footprint," << i << "," << (UINT64)intervalInsFootprint[i] << endl;
+            *out << "interval_data_footprint," << i << "," << (UINT64)intervalDataFootprint[i] << endl;
+        }
+    }
+    else {
+        *out << "footprint,instruction," << unique_ins.size() << endl;
+        *out << "footprint,data," << unqiue_data.size() << endl;
+    }
+
+    PrintCsvHistogram("instruction_length", s.insLenCount, INS_LEN_BUCKETS);
+    PrintCsvHistogram("operands", s.numOperandsCount, OPERAND_BUCKETS);
+    PrintCsvHistogram("register_read_operands", s.regReadOperandsCount, OPERAND_BUCKETS);
+    PrintCsvHistogram("register_write_operands", s.regWriteOperandsCount, OPERAND_BUCKETS);
+    PrintCsvHistogram("memory_operands", s.memOpsCount, OPERAND_BUCKETS);
+    PrintCsvHistogram("memory_read_operands", s.readMemOpsCount, OPERAND_BUCKETS);
+    PrintCsvHistogram("memory_write_operands", s.writeMemOpsCount, OPERAND_BUCKETS);
+
+    *out << "memory_bytes_touched,max," << s.maxBytesAccessed << endl;
+    *out << "memory_bytes_touched,average," << (s.totalMemIns ? s.bytesAccessed / (double)s.totalMemIns : 0.0) << endl;
+    *out << "immediate,max," << s.maxImmediate << endl;
+    *out << "immediate,min," << s.minImmediate << endl;
+    *out << "displacement,max," << s.maxDisp << endl;
+    *out << "displacement,min," << s.minDisp << endl;
+    *out << "time,execution_time_s," << elapsed_time_s << endl;
+
+    for (UINT32 t = 0; t < threadStats.size(); t++) {
+        const ThreadStats* ts = threadStats[t];
+        for (UINT32 i = 0; i < category_count; i++)
+            *out << "thread" << ts->tid << "," << category_names[i] << "," << ts->stats.categories[i] << endl;
+        *out << "thread" << ts->tid << ",Total," << ts->stats.TotalCategoryCount() << endl;
+        if (!approxFootprint)
+            *out << "thread" << ts->tid << ",data_footprint," << ts->dataFootprint.size() << endl;
+    }
+}
+
+// Short per-thread report: the category mix and the thread's own data footprint
+VOID PrintThreadText(const ThreadStats* t) {
+    UINT64 total = t->stats.TotalCategoryCount();
+
+    *out << endl;
+    printElement("-----------------------------------------------------------------------------------------------------------"); *out << endl;
+    printElement("Thread "); printElement(t->tid); *out << endl;
+    printElement("Category"); printElement("InsCount"); printElement("Percentage"); *out << endl;
+    for (UINT32 i = 0; i < category_count; i++) {
+        printElement(category_names[i]); printElement(t->stats.categories[i]); printElement((t->stats.categories[i]/(float)total) * 100.0); *out << endl;
+    }
+    printElement("Total Ins"); printElement(total); *out << endl;
+    if (!approxFootprint) {
+        printElement("Data Footprint: "); printElement(t->dataFootprint.size()); *out << endl;
+    }
+}
+
+// Analysis routine to exit the application
+void MyExitRoutine (THREADID tid) {
+	// Do an exit system call to exit the application.
+	// As we are calling the exit system call PIN would not be able to instrument application end.
+	// Because of this, even if you are instrumenting the application end, the Fini function would not
+	// be called. Thus you should report the statistics here, before doing the exit system call.
+
+    INT64 elapsed_time_s = RuntimeElapsedSeconds();
+
+    // Other threads may still be running; the lock only keeps two of them from reporting at once
+    PIN_GetLock(&stats_lock, tid + 1);
+
+    // Close the partial last footprint interval
+    if (approxFootprint && footprintInterval) {
+        PIN_GetLock(&footprint_lock, tid + 1);
+        CloseFootprintInterval();
+        PIN_ReleaseLock(&footprint_lock);
+    }
+
+    // Close the partial last CPI interval
+    if (cpiInterval)
+        CloseCpiInterval();
+
+    // Merge the per-thread shards
+    InsStats stats;
+    for (UINT32 i = 0; i < threadStats.size(); i++) {
+        stats.Merge(threadStats[i]->stats);
+        unqiue_data.Merge(threadStats[i]->dataFootprint);
+    }
+
+    // Calculate total ins executed
+    UINT64 insCategoryTotalCount = stats.TotalCategoryCount();
+    CPI = ModelCycles(stats) / insCategoryTotalCount;
+
+    // Print the stats here and then exit
+    switch (outputFormat) {
+        case format_json:
+            PrintJson(stats, insCategoryTotalCount, elapsed_time_s);
+            break;
+        case format_csv:
+            PrintCsv(stats, insCategoryTotalCount, elapsed_time_s);
+            break;
+        default:
+            PrintText(stats, insCategoryTotalCount, elapsed_time_s);
+            if (threadStats.size() > 1)
+                for (UINT32 i = 0; i < threadStats.size(); i++)
+                    PrintThreadText(threadStats[i]);
+            break;
+    }
+
     exit(0);
 }
 
@@ -375,35 +1457,120 @@ void MyExitRoutine (void) {
 // Instrumentation callbacks
 /* ===================================================================== */
 
+// Group an instruction's ISA extension
+static UINT32 ExtensionOf(INS ins) {
+    switch (INS_Extension(ins)) {
+        case XED_EXTENSION_X87:
+            return ext_x87;
+        case XED_EXTENSION_MMX:
+        case XED_EXTENSION_3DNOW:
+            return ext_mmx;
+        case XED_EXTENSION_SSE:
+        case XED_EXTENSION_SSE2:
+        case XED_EXTENSION_SSE3:
+        case XED_EXTENSION_SSSE3:
+        case XED_EXTENSION_SSE4:
+        case XED_EXTENSION_SSE4A:
+            return ext_sse;
+        case XED_EXTENSION_AVX:
+            return ext_avx;
+        case XED_EXTENSION_AVX2:
+        case XED_EXTENSION_AVX2GATHER:
+            return ext_avx2;
+        case XED_EXTENSION_AVX512EVEX:
+        case XED_EXTENSION_AVX512VEX:
+            return ext_avx512;
+        case XED_EXTENSION_FMA:
+        case XED_EXTENSION_FMA4:
+            return ext_fma;
+        case XED_EXTENSION_BMI1:
+        case XED_EXTENSION_BMI2:
+            return ext_bmi;
+        case XED_EXTENSION_AES:
+        case XED_EXTENSION_PCLMULQDQ:
+        case XED_EXTENSION_SHA:
+        case XED_EXTENSION_F16C:
+            return ext_other;
+        default:
+            return ext_base;
+    }
+}
+
+// Operation width of a SIMD instruction, width_none for everything else
+static UINT32 VectorWidthOf(INS ins, UINT32 extension) {
+    if (extension == ext_base || extension == ext_x87 || extension == ext_bmi)
+        return width_none;
+    if (extension == ext_mmx)
+        return width_64;
+
+    xed_decoded_inst_t* xedd = INS_XedDec(ins);
+    if (xed_decoded_inst_get_attribute(xedd, XED_ATTRIBUTE_SIMD_SCALAR))
+        return width_scalar;
+
+    switch (xed_decoded_inst_vector_length_bits(xedd)) {
+        case 128: return width_128;
+        case 256: return width_256;
+        case 512: return width_512;
+        default:  return width_none;
+    }
+}
+
+// Routine the block belongs to, created on first sight
+static RoutineStats* GetRoutineStats(INS ins) {
+    RTN rtn = INS_Rtn(ins);
+    ADDRINT key = RTN_Valid(rtn) ? RTN_Address(rtn) : 0;
+
+    PIN_GetLock(&routine_lock, PIN_ThreadId() + 1);
+    RoutineStats*& r = routines[key];
+    if (r == NULL) {
+        r = new RoutineStats;
+        r->name = RTN_Valid(rtn) ? RTN_Name(rtn) : "[unknown]";
+        r->ins = 0;
+        memset(r->counts, 0, sizeof(r->counts));
+    }
+    PIN_ReleaseLock(&routine_lock);
+    return r;
+}
+
 inline void CategoryCount(BBL bbl) {
-   
+
+    // Increments shared by every execution of the block, merged per counter
+    map<UINT32, UINT32> increments;
+    BblDelta* delta = new BblDelta;
+    delta->numIns = BBL_NumIns(bbl);
+    delta->bytesAccessed = 0;
+    delta->seenEpoch = 0;
+    delta->maxImmediate = -INT_MAX;
+    delta->minImmediate = INT_MAX;
+    delta->maxBytesAccessed = 0;
+    delta->routine = topRoutines ? GetRoutineStats(BBL_InsHead(bbl)) : NULL;
+    map<UINT32, UINT32> routineIncrements;
+
     for(INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
     {
-        // FastForward() is called for every ins executed
-        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)FastForward, IARG_END);
-
-        // Find instruction footprint
-        INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)InstructionAnalysis, 
-                                                IARG_INST_PTR, 
-                                                IARG_UINT32, INS_Size(ins), 
-                                                IARG_UINT32, INS_OperandCount(ins),
-                                                IARG_UINT32, INS_MaxNumRRegs(ins),
-                                                IARG_UINT32, INS_MaxNumWRegs(ins),
-                                                IARG_END);
-        
+        // Instruction footprint and static shape of every instruction
+        ADDRINT ipa = INS_Address(ins);
+        for(UINT64 i = (ipa>>5); i <= ((ipa+INS_Size(ins)) >> 5); i++) {
+            delta->insBlocks.push_back(i);
+        }
+
+        increments[STAT_BUCKET(insLenCount, INS_Size(ins))] += 1;
+        increments[STAT_BUCKET(numOperandsCount, INS_OperandCount(ins))] += 1;
+        increments[STAT_BUCKET(regReadOperandsCount, INS_MaxNumRRegs(ins))] += 1;
+        increments[STAT_BUCKET(regWriteOperandsCount, INS_MaxNumWRegs(ins))] += 1;
+
         for(UINT32 op =0; op < INS_OperandCount(ins); op++) {
             if(INS_OperandIsImmediate(ins, op)){
-                INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)FastForward, IARG_END);
-                ADDRINT val = INS_OperandImmediate(ins, op);
-                INS_InsertThenCall(
-                    ins,
-                    IPOINT_BEFORE,
-                    (AFUNPTR)ImmediateCount,
-                    IARG_ADDRINT, val,
-                    IARG_END
-                );
+                INT32 val = (INT32)INS_OperandImmediate(ins, op);
+                if(val > delta->maxImmediate)
+                    delta->maxImmediate = val;
+                if(val < delta->minImmediate)
+                    delta->minImmediate = val;
             }
         }
+
+        // Only instructions that can be skipped by their predicate need their own calls
+        BOOL predicated = INS_IsPredicated(ins);
         
         // Count load and store instructions for type B
         UINT32 memOperands = INS_MemoryOperandCount(ins);
@@ -423,13 +1590,11 @@ inline void CategoryCount(BBL bbl) {
                 loadCount += (rwSize >> 2);
                 loadCount += ((rwSize & 0x3) ? 1 : 0);
 
-                // FastForward() is called for every ins executed
-                INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)FastForward, IARG_END);
-                INS_InsertThenPredicatedCall(
+                insert_predicated_call(
                     ins,
-                    IPOINT_BEFORE,
                     (AFUNPTR)MemoryAnalysis,
-                    IARG_PTR, &(insCategoryCount.loads),
+                    IARG_THREAD_ID,
+                    IARG_UINT32, STAT_OFFSET(categories[cat_loads]),
                     IARG_UINT32, loadCount,
                     IARG_UINT32, rwSize,
                     IARG_MEMORYOP_EA, memOp,
@@ -446,13 +1611,11 @@ inline void CategoryCount(BBL bbl) {
                 storeCount += (rwSize >> 2);
                 storeCount += ((rwSize & 0x3) ? 1 : 0);
 
-                // FastForward() is called for every ins executed
-                INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)FastForward, IARG_END);
-                INS_InsertThenPredicatedCall(
+                insert_predicated_call(
                     ins,
-                    IPOINT_BEFORE,
                     (AFUNPTR)MemoryAnalysis,
-                    IARG_PTR, &(insCategoryCount.stores),
+                    IARG_THREAD_ID,
+                    IARG_UINT32, STAT_OFFSET(categories[cat_stores]),
                     IARG_UINT32, storeCount,
                     IARG_UINT32, rwSize,
                     IARG_MEMORYOP_EA, memOp,
@@ -462,105 +1625,134 @@ inline void CategoryCount(BBL bbl) {
             }
         }
 
-        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)FastForward, IARG_END);
-        INS_InsertThenPredicatedCall(
-            ins,
-            IPOINT_BEFORE,
-            (AFUNPTR)MemoryOperandCount,
-            IARG_UINT32, loadOperands,
-            IARG_UINT32, storeOperands,
-            IARG_UINT32, totalBytesAccessed,
-            IARG_END
-        );
+        if (predicated) {
+            insert_predicated_call(
+                ins,
+                (AFUNPTR)MemoryOperandCount,
+                IARG_THREAD_ID,
+                IARG_UINT32, loadOperands,
+                IARG_UINT32, storeOperands,
+                IARG_UINT32, totalBytesAccessed,
+                IARG_END
+            );
+        }
+        else {
+            increments[STAT_BUCKET(readMemOpsCount, loadOperands)] += 1;
+            increments[STAT_BUCKET(writeMemOpsCount, storeOperands)] += 1;
+            increments[STAT_BUCKET(memOpsCount, loadOperands+storeOperands)] += 1;
+            if(loadOperands+storeOperands) {
+                delta->bytesAccessed += totalBytesAccessed;
+                if(totalBytesAccessed > delta->maxBytesAccessed)
+                    delta->maxBytesAccessed = totalBytesAccessed;
+                increments[STAT_OFFSET(totalMemIns)] += 1;
+            }
+        }
 
         // Categorize all instructions for type A
         UINT32 category = INS_Category(ins);
-        UINT32* aType = NULL;
+        UINT32 aType = 0;
         
         switch(category) {
             case XED_CATEGORY_NOP:
-            {   aType = &(insCategoryCount.nop);
+            {   aType = STAT_OFFSET(categories[cat_nop]);
                 break;
             }
             case XED_CATEGORY_CALL: 
             {
                 if(INS_IsDirectCall(ins)) {
                     // Increment direct call count by one   
-                    aType = &(insCategoryCount.directCall);                
+                    aType = STAT_OFFSET(categories[cat_direct_call]);                
                 }
                 else {  
-                    aType = &(insCategoryCount.indirectCall);               
+                    aType = STAT_OFFSET(categories[cat_indirect_call]);               
                 }
 
                 break;
             }
             case XED_CATEGORY_RET: 
-            {   aType = &(insCategoryCount.returns);                    
+            {   aType = STAT_OFFSET(categories[cat_returns]);                    
                 break;
             }
             case XED_CATEGORY_UNCOND_BR: 
-            {   aType = &(insCategoryCount.unconditionalBranch);                    
+            {   aType = STAT_OFFSET(categories[cat_unconditional_branch]);                    
                 break;
             }
             case XED_CATEGORY_COND_BR: 
-            {   aType = &(insCategoryCount.conditionalBranch);                    
+            {   aType = STAT_OFFSET(categories[cat_conditional_branch]);                    
                 break;
             }
             case XED_CATEGORY_LOGICAL: 
-            {   aType = &(insCategoryCount.logicalOps);                    
+            {   aType = STAT_OFFSET(categories[cat_logical_ops]);                    
                 break;
             }
             case XED_CATEGORY_ROTATE:
             case XED_CATEGORY_SHIFT:
-            {   aType = &(insCategoryCount.rotateAndShift);
+            {   aType = STAT_OFFSET(categories[cat_rotate_and_shift]);
                 break;
             }
             case XED_CATEGORY_FLAGOP: 
-            {   aType = &(insCategoryCount.flagOps);                    
+            {   aType = STAT_OFFSET(categories[cat_flag_ops]);                    
                 break;
             }
             case XED_CATEGORY_AVX:
             case XED_CATEGORY_AVX2:
             case XED_CATEGORY_AVX2GATHER:
             case XED_CATEGORY_AVX512:
-            {   aType = &(insCategoryCount.vectorIns);
+            {   aType = STAT_OFFSET(categories[cat_vector_ins]);
                 break;
             }
             case XED_CATEGORY_CMOV: 
-            {   aType = &(insCategoryCount.conditionalMoves);                    
+            {   aType = STAT_OFFSET(categories[cat_conditional_moves]);                    
                 break;
             }
             case XED_CATEGORY_MMX:
             case XED_CATEGORY_SSE:
-            {   aType = &(insCategoryCount.mmxSSEIns);
+            {   aType = STAT_OFFSET(categories[cat_mmx_sse_ins]);
                 break;
             }
             case XED_CATEGORY_SYSCALL: 
-            {   aType = &(insCategoryCount.syscalls);                    
+            {   aType = STAT_OFFSET(categories[cat_syscalls]);                    
                 break;
             }
             case XED_CATEGORY_X87_ALU: 
-            {   aType = &(insCategoryCount.fpIns);                    
+            {   aType = STAT_OFFSET(categories[cat_fp_ins]);                    
                 break;
             }
             default:
-            {   aType = &(insCategoryCount.others);
+            {   aType = STAT_OFFSET(categories[cat_others]);
                 break;
             }
         }
 
-        // FastForward() is called for every ins executed
-        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)FastForward, IARG_END);
-        INS_InsertThenPredicatedCall(
-            ins,
-            IPOINT_BEFORE,
-            (AFUNPTR)IncCategoryCounter,
-            IARG_PTR, aType,
-            IARG_END
-        );
-
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)CountIns, IARG_END);
+        // ISA extension and vector width
+        UINT32 extension = ExtensionOf(ins);
+        UINT32 width = VectorWidthOf(ins, extension);
+        routineIncrements[extension] += 1;
+        routineIncrements[extension_count + width] += 1;
+
+        if (predicated) {
+            insert_predicated_call(
+                ins,
+                (AFUNPTR)IncCategoryCounter,
+                IARG_THREAD_ID,
+                IARG_UINT32, aType,
+                IARG_UINT32, STAT_BUCKET(extensions, extension),
+                IARG_UINT32, STAT_BUCKET(vectorWidths, width),
+                IARG_END
+            );
+        }
+        else {
+            increments[aType] += 1;
+            increments[STAT_BUCKET(extensions, extension)] += 1;
+            increments[STAT_BUCKET(vectorWidths, width)] += 1;
+        }
     }
+
+    delta->counters.assign(increments.begin(), increments.end());
+    if (delta->routine)
+        delta->routineCounts.assign(routineIncrements.begin(), routineIncrements.end());
+
+    insert_bbl_call(bbl, (AFUNPTR)ApplyBblDelta, IARG_THREAD_ID, IARG_PTR, delta, IARG_END);
 }
 
 /*!
@@ -575,17 +1767,29 @@ VOID Trace(TRACE trace, VOID* v)
 {
     // Visit every basic block in the trace
     for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
-    {   
-        BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)Terminate, IARG_END);
+    {
+        // Simulation point mode: only the basic block vector, for the whole run
+        if (simpointInterval) {
+            PIN_GetLock(&bbv_lock, PIN_ThreadId() + 1);
+            BbvBlock*& block = bbvBlocks[BBL_Address(bbl)];
+            if (block == NULL) {
+                block = new BbvBlock;
+                block->count = 0;
+                block->id = bbvBlockList.size();
+                bbvBlockList.push_back(block);
+            }
+            PIN_ReleaseLock(&bbv_lock);
 
-        // MyExitRoutine() is called only when the last call returns a non-zero value.
-        BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)MyExitRoutine, IARG_END);
+            BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)BbvCount, IARG_PTR, block, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+            continue;
+        }
 
-        // Insert all the calls here onc     e you have fast forwarded the given amount of ins
-        CategoryCount(bbl);
+        // Markers, fast-forward and the terminate check; MyExitRoutine() ends the window
+        if (RuntimeInstrumentBbl(bbl))
+            continue;
 
-        // Insert a call to CountBbl() before every basic block, passing the number of instructions
-        // BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)CountIns, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+        // Insert all the calls here once you have fast forwarded the given amount of ins
+        CategoryCount(bbl);
     }
 }
 
@@ -601,7 +1805,29 @@ VOID Trace(TRACE trace, VOID* v)
  */
 VOID Fini(INT32 code, VOID* v)
 {
-    MyExitRoutine();
+    // Simulation point mode runs to completion and only reports the points
+    if (simpointInterval) {
+        WriteSimPoints();
+        return;
+    }
+
+    MyExitRoutine(PIN_ThreadId());
+}
+
+/*!
+ * Give every new thread its own counter block.
+ */
+VOID ThreadStart(THREADID tid, CONTEXT* ctxt, INT32 flags, VOID* v)
+{
+    ThreadStats* t = new ThreadStats;
+    t->tid = tid;
+    t->cache = cacheProto;
+
+    PIN_GetLock(&stats_lock, tid + 1);
+    threadStats.push_back(t);
+    PIN_ReleaseLock(&stats_lock);
+
+    PIN_SetThreadData(tls_key, t, tid);
 }
 
 /*!
@@ -613,6 +1839,9 @@ VOID Fini(INT32 code, VOID* v)
  */
 int main(int argc, char* argv[])
 {
+    // Routine names for the -top_routines report
+    PIN_InitSymbols();
+
     // Initialize PIN library. Print help message if -h(elp) is specified
     // in the command line or the command line is invalid
     if (PIN_Init(argc, argv))
@@ -623,30 +1852,84 @@ int main(int argc, char* argv[])
     outputFile = KnobOutputFile.Value();
 
     cout << "outFile: " << outputFile << endl;
-    if (!outputFile.empty())
+    out = RuntimeOpenOutput(outputFile);
+
+    RuntimeInit(KnobFastForwardCount.Value() * ONE_BILLION, ONE_BILLION, (AFUNPTR)MyExitRoutine);
+    cout << "FF count: " << rt_fast_forward << endl;
+
+    for (outputFormat = 0; outputFormat < format_names.size(); outputFormat++)
+        if (format_names[outputFormat] == KnobFormat.Value())
+            break;
+    if (outputFormat == format_names.size())
     {
-        out = new std::ofstream(outputFile.c_str());
+        cerr << "Unknown output format: " << KnobFormat.Value() << endl;
+        return Usage();
+    }
+
+    approxFootprint = KnobApprox.Value();
+    if (approxFootprint) {
+        UINT32 precision = HyperLogLog::PrecisionFor(KnobApproxError.Value());
+        insSketch = dataSketch = HyperLogLog(precision);
+        footprintInterval = KnobFootprintInterval.Value();
+        if (footprintInterval) {
+            intervalInsSketch = intervalDataSketch = HyperLogLog(precision);
+            nextFootprintInterval = footprintInterval;
+        }
+        cout << "HyperLogLog precision: " << precision << endl;
     }
 
-    fastForwardCount = KnobFastForwardCount.Value();
-    fastForwardCount *= ONE_BILLION;
-    cout << "FF count: " << fastForwardCount << endl;
+    simpointInterval = KnobSimpointInterval.Value() * ONE_MILLION;
+    if (simpointInterval) {
+        nextSimpointInterval = simpointInterval;
+        cout << "SimPoint interval: " << simpointInterval << endl;
+    }
+
+    // CPI model: unit latency per category and 69 extra cycles per memory access unless configured
+    for (UINT32 i = 0; i < category_count; i++)
+        cpiModel.latency[i] = 1;
+    cpiModel.memoryLatency = 69;
+    cpiModel.hitLatency = 1;
+    cpiModel.missLatency = 69;
+    if (!KnobCpiConfig.Value().empty() && !LoadCpiModel(KnobCpiConfig.Value()))
+    {
+        cerr << "Cannot load CPI model: " << KnobCpiConfig.Value() << endl;
+        return Usage();
+    }
+
+    if (!KnobCache.Value().empty())
+    {
+        UINT32 size = 0, ways = 0, line = 0;
+        if (sscanf(KnobCache.Value().c_str(), "%u:%u:%u", &size, &ways, &line) != 3 ||
+            ways == 0 || line == 0 || (line & (line - 1)) || size < ways * line || size % (ways * line) ||
+            ((size / (ways * line)) & (size / (ways * line) - 1)))
+        {
+            cerr << "Invalid cache configuration: " << KnobCache.Value() << endl;
+            return Usage();
+        }
+        cacheProto = DataCache(size, ways, line);
+    }
+
+    cpiInterval = KnobCpiInterval.Value();
+    nextCpiInterval = cpiInterval;
+
+    PIN_InitLock(&stats_lock);
+    PIN_InitLock(&footprint_lock);
+    PIN_InitLock(&bbv_lock);
+    PIN_InitLock(&routine_lock);
+    topRoutines = KnobTopRoutines.Value();
+    tls_key = PIN_CreateThreadDataKey(NULL);
 
     // Register function to be called to instrument traces
     TRACE_AddInstrumentFunction(Trace, 0);
 
+    // Register function to be called when a thread starts
+    PIN_AddThreadStartFunction(ThreadStart, 0);
+
     // Register function to be called when the application exits
     PIN_AddFiniFunction(Fini, 0);
 
-    cerr << "===============================================" << endl;
-    cerr << "This application is instrumented by MyPinTool" << endl;
-    if (!KnobOutputFile.Value().empty())
-    {
-        cerr << "See file " << KnobOutputFile.Value() << " for analysis results" << endl;
-    }
-    cerr << "===============================================" << endl;
+    RuntimeBanner("MyPinTool", KnobOutputFile.Value());
 
-    t_start = std::chrono::high_resolution_clock::now();
     // Start the program, never returns
     PIN_StartProgram();
 
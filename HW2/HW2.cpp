@@ -17,6 +17,13 @@
 #include <iomanip>
 #include <limits.h>
 #include <ctime>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include "../common/pin_runtime.H"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 
 using std::cerr;
@@ -28,13 +35,21 @@ using std::map;
 using std::left;
 using std::setw;
 using std::setfill;
+using std::stringstream;
 
 #define MASK_512 511
 #define MASK_1024 1023
-#define MASK_128 127
 
 #define BTB_SETS 128
 #define BTB_WAYS 4
+#define BTB_MAX_WAYS 32
+
+#define ITTAGE_HIST_BITS 1024
+#define ITTAGE_TAG_BITS 11
+#define ITTAGE_MAX_TABLES 16
+#define VPC_MAX_ITER 16
+
+#define BBV_DIMS 16
 
 #define printer(out, strat, tcount, tfrac, ffrac, bfrac)                                    \
 { 							                                                                \
@@ -84,44 +99,308 @@ enum Direction
     directions
 };
 
-typedef struct BtbEntry 
+enum BtbReplacement
+{
+    btb_lru,
+    btb_fifo,
+    btb_nru,
+    btb_random,
+
+    btb_policies
+};
+
+static vector<string> btb_policy_names = {"lru", "fifo", "nru", "random"};
+
+enum BtbIndex
+{
+    btb_index_pc,       // set = pc bits, tag = remaining pc bits
+    btb_index_ghr,      // set = pc bits xor global history, tag = full pc
+
+    btb_indexes
+};
+
+static vector<string> btb_index_names = {"pc", "ghr"};
+
+/*
+ * Set-associative BTB kept in flat arrays of sets * ways entries. Tags are
+ * stored apart from targets so that all ways of a set can be matched with
+ * SIMD compares, and valid/reference bits are per-set bitmasks.
+ */
+class BTB
+{
+public:
+    BTB(string name, UINT32 sets, UINT32 ways, UINT32 tag_bits, UINT32 policy, UINT32 index);
+
+    VOID Access(ADDRINT InsAddr, ADDRINT BranchAddr, BOOL taken, UINT32 InsSize, UINT64 ghr);
+    BOOL Probe(ADDRINT InsAddr, UINT64 ghr, ADDRINT* target);
+    VOID Fill(ADDRINT InsAddr, UINT64 ghr, ADDRINT target);
+
+    string name;
+    UINT32 sets;
+    UINT32 ways;
+    UINT32 tag_bits;
+    UINT32 policy;
+    UINT32 index;
+
+    UINT64 preds;
+    UINT64 fails;
+    UINT64 misses;
+
+private:
+    VOID Locate(ADDRINT InsAddr, UINT64 ghr, UINT32* set, UINT64* tag);
+    INT32 Lookup(UINT32 set, UINT64 tag);
+    UINT32 Victim(UINT32 set);
+    VOID Touch(UINT32 set, UINT32 way, BOOL fill);
+
+    UINT32 set_bits;
+    UINT64 tag_mask;
+    UINT32 way_mask;
+
+    vector<UINT64> tags;
+    vector<ADDRINT> targets;
+    vector<UINT64> stamps;
+    vector<UINT32> valid;
+    vector<UINT32> ref;
+
+    UINT64 clock;
+    UINT64 rng;
+};
+
+enum RasOverflow
 {
-    BOOL valid;
-    ADDRINT tag;
-    UINT64 lru_state;
+    ras_wrap,       // circular stack, a push on a full stack overwrites the oldest entry
+    ras_drop,       // a push on a full stack is discarded
+
+    ras_policies
+};
+
+static vector<string> ras_policy_names = {"wrap", "drop"};
+
+/*
+ * Return address stack: calls push the fall-through address, returns pop
+ * it and compare against the actual return target.
+ */
+class RAS
+{
+public:
+    RAS(UINT32 depth, UINT32 policy);
+
+    VOID Push(ADDRINT ReturnAddr);
+    VOID Pop(ADDRINT Target);
+
+    UINT32 depth;
+    UINT32 policy;
+
+    UINT64 preds;
+    UINT64 fails;
+    UINT64 overflows;
+    UINT64 underflows;
+
+private:
+    vector<ADDRINT> stack;
+    UINT32 top;
+    UINT32 count;
+};
+
+typedef struct IttageEntry
+{
+    UINT16 tag;
+    UINT8 ctr;          // 2-bit confidence
+    UINT8 u;            // useful bit
     ADDRINT target;
-} BTB_ENTRY;
+} ITTAGE_ENTRY;
+
+/*
+ * Global history folded down to a table index or tag width, updated
+ * incrementally as bits enter and leave the history window.
+ */
+class FoldedHistory
+{
+public:
+    VOID Init(UINT32 original_length, UINT32 compressed_length);
+    VOID Update(const UINT8* hist, UINT32 pt);
+
+    UINT32 comp;
+    UINT32 olength;
+    UINT32 clength;
+    UINT32 outpoint;
+};
+
+/*
+ * ITTAGE indirect target predictor: a pc-indexed base target table backed
+ * by tagged tables indexed with geometrically increasing history lengths.
+ */
+class ITTAGE
+{
+public:
+    ITTAGE(UINT32 num_tables, UINT32 log_entries, UINT32 min_hist, UINT32 max_hist);
+
+    VOID Access(ADDRINT InsAddr, ADDRINT Target);
+    VOID PushHistory(UINT32 bit);
+
+    UINT32 num_tables;
+    UINT32 log_entries;
+    vector<UINT32> hist_len;
+
+    UINT64 preds;
+    UINT64 fails;
+
+private:
+    UINT32 Index(ADDRINT InsAddr, UINT32 t);
+    UINT32 Tag(ADDRINT InsAddr, UINT32 t);
+
+    vector<ADDRINT> base;
+    vector<ITTAGE_ENTRY> tables;     // num_tables * (1 << log_entries), flat
+    vector<FoldedHistory> idx_fold;
+    vector<FoldedHistory> tag_fold0;
+    vector<FoldedHistory> tag_fold1;
+
+    UINT8 hist[ITTAGE_HIST_BITS];
+    UINT32 pt;
+    UINT64 tick;
+    UINT64 rng;
+};
+
+/*
+ * VPC prediction: an indirect branch is predicted as a sequence of virtual
+ * conditional branches at hashed pcs, each backed by a BTB entry and a
+ * gshare direction counter. The first virtual branch predicted taken
+ * supplies the target.
+ */
+class VPC
+{
+public:
+    VPC(UINT32 max_iter, UINT32 log_entries);
+
+    VOID Access(ADDRINT InsAddr, ADDRINT Target, UINT64 ghr);
+
+    UINT32 max_iter;
+    UINT32 log_entries;
+
+    UINT64 preds;
+    UINT64 fails;
+    UINT64 iterations;
+
+private:
+    ADDRINT VirtualPc(ADDRINT InsAddr, UINT32 iter);
+    UINT32 PhtIndex(ADDRINT vpc, UINT64 vghr);
+    VOID Train(ADDRINT InsAddr, UINT64 ghr, UINT32 last);
+
+    BTB btb;
+    vector<UINT8> pht;
+};
+
+enum SweepKind
+{
+    sweep_bimodal,
+    sweep_gag,
+    sweep_gshare,
+    sweep_sag,
+
+    sweep_kinds
+};
+
+static vector<string> sweep_names = {"Bimodal", "GAg", "gshare", "SAg"};
+
+/*
+ * Direction predictor with a configurable pattern table size and history
+ * length, instantiated many times over by the storage sweep. Counter
+ * widths follow the fixed predictors: 2 bits for bimodal and SAg, 3 bits
+ * for GAg and gshare.
+ */
+class SizedPredictor
+{
+public:
+    SizedPredictor(UINT32 kind, UINT32 log_pht, UINT32 hist_bits, UINT32 log_bht);
+
+    VOID Access(ADDRINT InsAddr, BOOL taken, UINT64 ghr);
+    UINT64 StorageBits() const;
+
+    UINT32 kind;
+    UINT32 log_pht;
+    UINT32 hist_bits;
+    UINT32 log_bht;
+
+    UINT64 preds;
+    UINT64 fails;
+
+private:
+    UINT8 ctr_max;
+    vector<UINT8> pht;
+    vector<UINT32> bht;
+};
+
+/*
+ * Every predictor table and history register for one guest thread, or for
+ * all threads in -shared mode. Threads copy a prototype built in main() so
+ * they all start from the same configuration.
+ */
+class PredictorSet
+{
+public:
+    PredictorSet(const vector<BTB>& btbs, const RAS& ras, const ITTAGE& ittage, const VPC& vpc,
+                 const vector<SizedPredictor>& sweep);
+
+    VOID Fnbt(ADDRINT InsAddr, ADDRINT BranchAddr, BOOL taken);
+    VOID Predict(ADDRINT InsAddr, ADDRINT BranchAddr, BOOL taken);
+    VOID BtbAccess(ADDRINT InsAddr, ADDRINT BranchAddr, BOOL taken, UINT32 InsSize);
+    VOID IndirectPredict(ADDRINT InsAddr, ADDRINT BranchAddr);
+    VOID Merge(const PredictorSet& other);
+
+    vector<vector<UINT64>> hits;
+    vector<vector<UINT64>> misses;
+
+    vector<UINT32> bimod_pht;
+    vector<UINT32> sag_bht;
+    vector<UINT32> sag_pht;
+    UINT32 ghr;
+    vector<UINT32> gag_pht;
+    vector<UINT32> gshare_pht;
+    vector<UINT32> meta_gag_sag;
+    vector<UINT32> meta_gag_gshare;
+    vector<UINT32> meta_gshare_sag;
+
+    UINT64 btb_ghr;
+    vector<BTB> btbs;
+
+    RAS ras;
+    ITTAGE ittage;
+    VPC vpc;
+
+    vector<SizedPredictor> sweep;
+};
 
 
-static UINT64 ff_cnt = 0;
 static UINT64 FF_MUL = 1000000000;
 static UINT64 instrument_cnt = 1000000000;
-static UINT64 icount = 0;
-static UINT64 pre_icount = 0;
-
-static vector<vector<UINT64>> hits;
-static vector<vector<UINT64>> misses;
-
-static vector<UINT32> bimod_pht(512, 0);
-static vector<UINT32> sag_bht(1024, 0);
-static vector<UINT32> sag_pht(512, 0);
-static UINT32 ghr = 0;
-static vector<UINT32> gag_pht(512, 0);
-static vector<UINT32> gshare_pht(512, 0);
-static vector<UINT32> meta_gag_sag(512, 0);
-static vector<UINT32> meta_gag_gshare(512, 0);
-static vector<UINT32> meta_gshare_sag(512, 0);
-
-static UINT64 btb_preds = 0;
-static UINT64 btb_fails = 0;
-static UINT64 btb_misses = 0;
-static UINT64 btb2_preds = 0;
-static UINT64 btb2_fails = 0;
-static UINT64 btb2_misses = 0;
-static UINT32 btb2_ghr = 0;
-static vector<vector<BTB_ENTRY*>> btb;
-static vector<vector<BTB_ENTRY*>> btb2;
-static UINT64 lru_num = 1;
+
+static TLS_KEY tls_key;
+static PIN_LOCK state_lock;
+static BOOL shared_state = false;
+static PredictorSet* proto = NULL;
+static vector<PredictorSet*> states;
+static vector<THREADID> state_tids;
+
+typedef struct BblInfo
+{
+    UINT64 count;       // instructions executed in this block during the current interval
+    UINT32 id;
+} BBL_INFO;
+
+static UINT64 interval_len = 0;
+static UINT64 interval_start = 0;
+static UINT64 next_snapshot = 0;
+static UINT32 interval_num = 0;
+static PIN_LOCK interval_lock;
+static map<ADDRINT, BBL_INFO*> bbl_map;
+static vector<BBL_INFO*> bbl_infos;
+static vector<UINT64> prev_fails;
+static vector<vector<double>> phases;
+static vector<UINT32> phase_intervals;
+static double phase_threshold = 0.1;
+
+std::ostream* series = NULL;
+std::ostream* bbv_out = NULL;
 
 std::ostream* out = &cerr;
 
@@ -134,6 +413,54 @@ KNOB< string > KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool", "o", "result.out",
 KNOB< UINT64 > KnobFastForward(KNOB_MODE_WRITEONCE, "pintool", "f", "0",
                                 "instruction count to fast forward");
 
+KNOB< BOOL > KnobShared(KNOB_MODE_WRITEONCE, "pintool", "shared", "0",
+                                "share one set of predictor tables between all threads");
+
+KNOB< string > KnobBtb(KNOB_MODE_APPEND, "pintool", "btb", "",
+                                "additional BTB to simulate, sets:ways[:tag_bits[:lru|fifo|nru|random[:pc|ghr]]]");
+
+KNOB< UINT32 > KnobRasDepth(KNOB_MODE_WRITEONCE, "pintool", "ras_depth", "16",
+                                "return address stack entries");
+
+KNOB< string > KnobRasOverflow(KNOB_MODE_WRITEONCE, "pintool", "ras_overflow", "wrap",
+                                "return address stack overflow policy, wrap|drop");
+
+KNOB< UINT32 > KnobIttageTables(KNOB_MODE_WRITEONCE, "pintool", "ittage_tables", "6",
+                                "number of ITTAGE tagged tables");
+
+KNOB< UINT32 > KnobIttageLogEntries(KNOB_MODE_WRITEONCE, "pintool", "ittage_log_entries", "9",
+                                "log2 of entries per ITTAGE table");
+
+KNOB< UINT32 > KnobIttageMinHist(KNOB_MODE_WRITEONCE, "pintool", "ittage_min_hist", "4",
+                                "shortest ITTAGE history length");
+
+KNOB< UINT32 > KnobIttageMaxHist(KNOB_MODE_WRITEONCE, "pintool", "ittage_max_hist", "256",
+                                "longest ITTAGE history length");
+
+KNOB< UINT32 > KnobVpcIter(KNOB_MODE_WRITEONCE, "pintool", "vpc_iter", "12",
+                                "maximum VPC prediction iterations");
+
+KNOB< string > KnobSweepSizes(KNOB_MODE_WRITEONCE, "pintool", "sweep_sizes", "",
+                                "comma separated log2 pattern table sizes to sweep, empty disables the sweep");
+
+KNOB< string > KnobSweepHist(KNOB_MODE_WRITEONCE, "pintool", "sweep_hist", "4,8,12",
+                                "comma separated history lengths to sweep for gshare and SAg");
+
+KNOB< UINT32 > KnobSweepBht(KNOB_MODE_WRITEONCE, "pintool", "sweep_bht", "10",
+                                "log2 of SAg history table entries in the sweep");
+
+KNOB< UINT64 > KnobInterval(KNOB_MODE_WRITEONCE, "pintool", "interval", "0",
+                                "instructions per time-series interval, 0 disables the time series");
+
+KNOB< string > KnobSeriesFile(KNOB_MODE_WRITEONCE, "pintool", "series", "series.out",
+                                "per-interval MPKI output file");
+
+KNOB< string > KnobBbvFile(KNOB_MODE_WRITEONCE, "pintool", "bbv", "bbv.out",
+                                "per-interval basic block vector signature output file");
+
+KNOB< double > KnobPhaseThreshold(KNOB_MODE_WRITEONCE, "pintool", "phase_threshold", "0.1",
+                                "signature distance below which an interval joins an existing phase");
+
 /* ===================================================================== */
 // Utilities
 /* ===================================================================== */
@@ -152,25 +479,556 @@ INT32 Usage()
     return -1;
 }
 
+static UINT32 Log2(UINT32 n) {
+    UINT32 bits = 0;
+    while ((1U << bits) < n)
+        bits++;
+    return bits;
+}
+
+static INT32 FindName(const vector<string>& names, const string& name) {
+    for (UINT32 i = 0; i < names.size(); i++)
+        if (names[i] == name)
+            return i;
+    return -1;
+}
+
+// Parses a comma separated list of small integers, false on malformed input
+static BOOL ParseList(const string& config, vector<UINT32>& values) {
+    stringstream ss(config);
+    string field;
+    while (std::getline(ss, field, ',')) {
+        if (field.empty() || field.find_first_not_of("0123456789") != string::npos)
+            return false;
+        values.push_back(atoi(field.c_str()));
+    }
+    return true;
+}
+
+/*!
+ *  Build a BTB from a -btb knob value: sets:ways[:tag_bits[:policy[:index]]].
+ *  Returns NULL if the description is malformed.
+ */
+BTB* ParseBtb(const string& config) {
+    vector<string> fields;
+    stringstream ss(config);
+    string field;
+    while (std::getline(ss, field, ':'))
+        fields.push_back(field);
+
+    if (fields.size() < 2 || fields.size() > 5)
+        return NULL;
+
+    UINT32 sets = atoi(fields[0].c_str());
+    UINT32 ways = atoi(fields[1].c_str());
+    UINT32 tag_bits = fields.size() > 2 ? atoi(fields[2].c_str()) : 0;
+    INT32 policy = fields.size() > 3 ? FindName(btb_policy_names, fields[3]) : btb_lru;
+    INT32 index = fields.size() > 4 ? FindName(btb_index_names, fields[4]) : btb_index_pc;
+
+    if (sets == 0 || (sets & (sets - 1)) || ways == 0 || ways > BTB_MAX_WAYS || tag_bits > 64)
+        return NULL;
+    if (policy < 0 || index < 0)
+        return NULL;
+
+    stringstream name;
+    name << "BTB " << sets << "x" << ways;
+    if (tag_bits)
+        name << " t" << tag_bits;
+    name << " " << btb_policy_names[policy] << " " << btb_index_names[index];
+
+    return new BTB(name.str(), sets, ways, tag_bits, policy, index);
+}
+
 /* ===================================================================== */
-// Analysis routines
+// BTB model
+/* ===================================================================== */
+
+BTB::BTB(string name, UINT32 sets, UINT32 ways, UINT32 tag_bits, UINT32 policy, UINT32 index)
+    : name(name), sets(sets), ways(ways), tag_bits(tag_bits), policy(policy), index(index),
+      preds(0), fails(0), misses(0),
+      tags(sets * ways, 0), targets(sets * ways, 0), stamps(sets * ways, 0),
+      valid(sets, 0), ref(sets, 0), clock(1), rng(0x9e3779b97f4a7c15ULL)
+{
+    set_bits = Log2(sets);
+    tag_mask = (tag_bits == 0 || tag_bits == 64) ? ~0ULL : ((1ULL << tag_bits) - 1);
+    way_mask = (ways == 32) ? ~0U : ((1U << ways) - 1);
+}
+
+// Returns the way holding tag in set, or -1 on a miss
+INT32 BTB::Lookup(UINT32 set, UINT64 tag) {
+    const UINT64* row = &tags[set * ways];
+    UINT32 hit = 0;
+    UINT32 w = 0;
+
+#ifdef __SSE2__
+    // Two 64-bit tags per compare: a way matches when both 32-bit halves do
+    __m128i key = _mm_set1_epi64x(tag);
+    for (; w + 2 <= ways; w += 2) {
+        __m128i t = _mm_loadu_si128((const __m128i*)(row + w));
+        __m128i eq = _mm_cmpeq_epi32(t, key);
+        eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+        hit |= (UINT32)_mm_movemask_pd(_mm_castsi128_pd(eq)) << w;
+    }
+#endif
+    for (; w < ways; w++)
+        hit |= (UINT32)(row[w] == tag) << w;
+
+    hit &= valid[set];
+    return hit ? __builtin_ctz(hit) : -1;
+}
+
+// Picks the way to fill: the first invalid way, otherwise per the policy
+UINT32 BTB::Victim(UINT32 set) {
+    UINT32 invalid = ~valid[set] & way_mask;
+    if (invalid)
+        return __builtin_ctz(invalid);
+
+    UINT32 base = set * ways;
+    UINT32 victim = 0;
+
+    switch (policy) {
+        case btb_lru:
+        case btb_fifo:
+            for (UINT32 w = 1; w < ways; w++)
+                if (stamps[base + w] < stamps[base + victim])
+                    victim = w;
+            break;
+        case btb_nru:
+        {
+            UINT32 unref = ~ref[set] & way_mask;
+            victim = unref ? __builtin_ctz(unref) : 0;
+            break;
+        }
+        case btb_random:
+            rng ^= rng << 13;
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+            victim = rng % ways;
+            break;
+    }
+
+    return victim;
+}
+
+VOID BTB::Touch(UINT32 set, UINT32 way, BOOL fill) {
+    switch (policy) {
+        case btb_lru:
+            stamps[set * ways + way] = clock++;
+            break;
+        case btb_fifo:
+            if (fill)
+                stamps[set * ways + way] = clock++;
+            break;
+        case btb_nru:
+            ref[set] |= (1U << way);
+            if ((ref[set] & way_mask) == way_mask)
+                ref[set] = (1U << way);
+            break;
+        default:
+            break;
+    }
+}
+
+VOID BTB::Locate(ADDRINT InsAddr, UINT64 ghr, UINT32* set, UINT64* tag) {
+    if (index == btb_index_ghr) {
+        *set = (InsAddr ^ ghr) & (sets - 1);
+        *tag = InsAddr & tag_mask;
+    }
+    else {
+        *set = InsAddr & (sets - 1);
+        *tag = ((UINT64)InsAddr >> set_bits) & tag_mask;
+    }
+}
+
+VOID BTB::Access(ADDRINT InsAddr, ADDRINT BranchAddr, BOOL taken, UINT32 InsSize, UINT64 ghr) {
+    UINT32 set;
+    UINT64 tag;
+    Locate(InsAddr, ghr, &set, &tag);
+
+    ADDRINT next_ins = InsAddr + InsSize;
+    INT32 way = Lookup(set, tag);
+    BOOL found = (way >= 0);
+    ADDRINT target = found ? targets[set * ways + way] : next_ins;
+
+    preds++;
+
+    if (taken) {
+        fails += (BranchAddr != target);
+
+        if (found && BranchAddr != target)
+            targets[set * ways + way] = BranchAddr;
+
+        if (found == false && BranchAddr != target) {
+            UINT32 fill = Victim(set);
+            tags[set * ways + fill] = tag;
+            targets[set * ways + fill] = BranchAddr;
+            valid[set] |= (1U << fill);
+            ref[set] &= ~(1U << fill);
+            Touch(set, fill, true);
+        }
+    }
+    else {
+        fails += (target != next_ins);
+        if (found)
+            valid[set] &= ~(1U << way);
+    }
+
+    if (found)
+        Touch(set, way, false);
+    else
+        misses++;
+}
+
+// Lookup without statistics, for predictors that use the BTB as target storage
+BOOL BTB::Probe(ADDRINT InsAddr, UINT64 ghr, ADDRINT* target) {
+    UINT32 set;
+    UINT64 tag;
+    Locate(InsAddr, ghr, &set, &tag);
+
+    INT32 way = Lookup(set, tag);
+    if (way < 0)
+        return false;
+
+    *target = targets[set * ways + way];
+    Touch(set, way, false);
+    return true;
+}
+
+VOID BTB::Fill(ADDRINT InsAddr, UINT64 ghr, ADDRINT target) {
+    UINT32 set;
+    UINT64 tag;
+    Locate(InsAddr, ghr, &set, &tag);
+
+    INT32 way = Lookup(set, tag);
+    BOOL found = (way >= 0);
+    if (!found) {
+        way = Victim(set);
+        tags[set * ways + way] = tag;
+        valid[set] |= (1U << way);
+        ref[set] &= ~(1U << way);
+    }
+    targets[set * ways + way] = target;
+    Touch(set, way, !found);
+}
+
+/* ===================================================================== */
+// Return address stack and indirect target predictors
+/* ===================================================================== */
+
+RAS::RAS(UINT32 depth, UINT32 policy)
+    : depth(depth), policy(policy), preds(0), fails(0), overflows(0), underflows(0),
+      stack(depth, 0), top(0), count(0)
+{
+}
+
+VOID RAS::Push(ADDRINT ReturnAddr) {
+    if (count == depth) {
+        overflows++;
+        if (policy == ras_drop)
+            return;
+    }
+    else {
+        count++;
+    }
+
+    top = (top + 1) % depth;
+    stack[top] = ReturnAddr;
+}
+
+VOID RAS::Pop(ADDRINT Target) {
+    preds++;
+
+    if (count == 0) {
+        underflows++;
+        fails++;
+        return;
+    }
+
+    fails += (stack[top] != Target);
+    top = (top + depth - 1) % depth;
+    count--;
+}
+
+VOID FoldedHistory::Init(UINT32 original_length, UINT32 compressed_length) {
+    comp = 0;
+    olength = original_length;
+    clength = compressed_length;
+    outpoint = olength % clength;
+}
+
+// hist[pt] is the newest bit, hist[pt + olength] the one leaving the window
+VOID FoldedHistory::Update(const UINT8* hist, UINT32 pt) {
+    comp = (comp << 1) ^ hist[pt & (ITTAGE_HIST_BITS - 1)];
+    comp ^= (UINT32)hist[(pt + olength) & (ITTAGE_HIST_BITS - 1)] << outpoint;
+    comp ^= (comp >> clength);
+    comp &= (1U << clength) - 1;
+}
+
+ITTAGE::ITTAGE(UINT32 num_tables, UINT32 log_entries, UINT32 min_hist, UINT32 max_hist)
+    : num_tables(num_tables), log_entries(log_entries), hist_len(num_tables, 0),
+      preds(0), fails(0),
+      base(1 << log_entries, 0), tables(num_tables << log_entries),
+      idx_fold(num_tables), tag_fold0(num_tables), tag_fold1(num_tables),
+      pt(0), tick(0), rng(0x2545f4914f6cdd1dULL)
+{
+    memset(hist, 0, sizeof(hist));
+    memset(&tables[0], 0, tables.size() * sizeof(ITTAGE_ENTRY));
+
+    // Geometric series min_hist .. max_hist
+    for (UINT32 t = 0; t < num_tables; t++) {
+        double ratio = num_tables > 1 ? (double)t / (num_tables - 1) : 0;
+        hist_len[t] = (UINT32)(min_hist * pow((double)max_hist / min_hist, ratio) + 0.5);
+
+        idx_fold[t].Init(hist_len[t], log_entries);
+        tag_fold0[t].Init(hist_len[t], ITTAGE_TAG_BITS);
+        tag_fold1[t].Init(hist_len[t], ITTAGE_TAG_BITS - 1);
+    }
+}
+
+UINT32 ITTAGE::Index(ADDRINT InsAddr, UINT32 t) {
+    UINT32 shift = (log_entries > t ? log_entries - t : 1);
+    return (InsAddr ^ (InsAddr >> shift) ^ idx_fold[t].comp) & ((1U << log_entries) - 1);
+}
+
+UINT32 ITTAGE::Tag(ADDRINT InsAddr, UINT32 t) {
+    return (InsAddr ^ tag_fold0[t].comp ^ (tag_fold1[t].comp << 1)) & ((1U << ITTAGE_TAG_BITS) - 1);
+}
+
+VOID ITTAGE::PushHistory(UINT32 bit) {
+    pt--;
+    hist[pt & (ITTAGE_HIST_BITS - 1)] = bit & 1;
+
+    for (UINT32 t = 0; t < num_tables; t++) {
+        idx_fold[t].Update(hist, pt);
+        tag_fold0[t].Update(hist, pt);
+        tag_fold1[t].Update(hist, pt);
+    }
+}
+
+VOID ITTAGE::Access(ADDRINT InsAddr, ADDRINT Target) {
+    UINT32 idx[ITTAGE_MAX_TABLES];
+    UINT32 tag[ITTAGE_MAX_TABLES];
+    UINT32 entries = 1U << log_entries;
+
+    for (UINT32 t = 0; t < num_tables; t++) {
+        idx[t] = Index(InsAddr, t);
+        tag[t] = Tag(InsAddr, t);
+    }
+
+    // Provider is the longest-history hit, alternate the next longest
+    INT32 provider = -1;
+    INT32 alt = -1;
+    for (INT32 t = num_tables - 1; t >= 0; t--) {
+        if (tables[t * entries + idx[t]].tag != tag[t])
+            continue;
+        if (provider < 0)
+            provider = t;
+        else {
+            alt = t;
+            break;
+        }
+    }
+
+    ADDRINT& base_target = base[InsAddr & (entries - 1)];
+    ITTAGE_ENTRY* pe = provider >= 0 ? &tables[provider * entries + idx[provider]] : NULL;
+    ADDRINT alt_target = alt >= 0 ? tables[alt * entries + idx[alt]].target : base_target;
+    ADDRINT provider_target = pe ? pe->target : base_target;
+
+    // A provider with no confidence yet defers to the alternate prediction
+    ADDRINT pred = (pe && pe->ctr == 0) ? alt_target : provider_target;
+
+    preds++;
+    fails += (pred != Target);
+
+    if (pe) {
+        if (provider_target == Target) {
+            if (pe->ctr < 3)
+                pe->ctr++;
+        }
+        else if (pe->ctr > 0)
+            pe->ctr--;
+        else
+            pe->target = Target;
+
+        if (provider_target != alt_target)
+            pe->u = (provider_target == Target);
+    }
+    else if (base_target != Target) {
+        base_target = Target;
+    }
+
+    // Allocate a longer-history entry on a misprediction
+    if (pred != Target && provider < (INT32)num_tables - 1) {
+        UINT32 start = provider + 1;
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        if ((rng & 1) && start + 1 < num_tables)
+            start++;
+
+        BOOL allocated = false;
+        for (UINT32 t = start; t < num_tables; t++) {
+            ITTAGE_ENTRY& e = tables[t * entries + idx[t]];
+            if (e.u == 0) {
+                e.tag = tag[t];
+                e.target = Target;
+                e.ctr = 0;
+                allocated = true;
+                break;
+            }
+        }
+        if (!allocated)
+            for (UINT32 t = provider + 1; t < num_tables; t++)
+                tables[t * entries + idx[t]].u = 0;
+    }
+
+    // Periodically age all useful bits so stale entries can be replaced
+    if ((++tick & ((1 << 18) - 1)) == 0)
+        for (UINT32 i = 0; i < tables.size(); i++)
+            tables[i].u = 0;
+
+    // Path history: two target bits per indirect branch
+    PushHistory(Target >> 2);
+    PushHistory(Target >> 3);
+}
+
+static const UINT64 vpc_hash[VPC_MAX_ITER] = {
+    0x0ULL,                0x5ac1b5a3c2e9f1d7ULL, 0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL,
+    0x165667b19e3779f9ULL, 0xd6e8feb86659fd93ULL, 0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+    0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL, 0x1d8e4e27c47d124fULL, 0xbf58476d1ce4e5b9ULL,
+    0x94d049bb133111ebULL, 0x2545f4914f6cdd1dULL, 0x61c8864680b583ebULL, 0xff51afd7ed558ccdULL
+};
+
+VPC::VPC(UINT32 max_iter, UINT32 log_entries)
+    : max_iter(max_iter), log_entries(log_entries), preds(0), fails(0), iterations(0),
+      btb("VPC BTB", BTB_SETS * 4, BTB_WAYS, 0, btb_lru, btb_index_pc),
+      pht(1 << log_entries, 1)
+{
+}
+
+// Iteration 0 is the real branch; later iterations are hashed virtual pcs
+ADDRINT VPC::VirtualPc(ADDRINT InsAddr, UINT32 iter) {
+    return InsAddr ^ (ADDRINT)vpc_hash[iter];
+}
+
+UINT32 VPC::PhtIndex(ADDRINT vpc, UINT64 vghr) {
+    return (vpc ^ vghr) & ((1U << log_entries) - 1);
+}
+
+// Virtual branches before last were not taken, last was taken
+VOID VPC::Train(ADDRINT InsAddr, UINT64 ghr, UINT32 last) {
+    UINT64 vghr = ghr;
+    for (UINT32 i = 0; i <= last; i++, vghr <<= 1) {
+        UINT8& ctr = pht[PhtIndex(VirtualPc(InsAddr, i), vghr)];
+        if (i == last) {
+            if (ctr < 3)
+                ctr++;
+        }
+        else if (ctr > 0)
+            ctr--;
+    }
+}
+
+VOID VPC::Access(ADDRINT InsAddr, ADDRINT Target, UINT64 ghr) {
+    INT32 pred_iter = -1;
+    INT32 found_iter = -1;
+    UINT32 iter = 0;
+    ADDRINT pred = 0;
+    UINT64 vghr = ghr;
+
+    for (; iter < max_iter; iter++, vghr <<= 1) {
+        ADDRINT vtarget;
+        ADDRINT vpc = VirtualPc(InsAddr, iter);
+        if (!btb.Probe(vpc, 0, &vtarget))
+            break;
+        if (pred_iter < 0 && pht[PhtIndex(vpc, vghr)] > 1) {
+            pred_iter = iter;
+            pred = vtarget;
+        }
+        if (found_iter < 0 && vtarget == Target)
+            found_iter = iter;
+    }
+
+    preds++;
+    iterations += (pred_iter >= 0 ? pred_iter + 1 : iter);
+    fails += (pred_iter < 0 || pred != Target);
+
+    if (found_iter >= 0) {
+        Train(InsAddr, ghr, found_iter);
+        return;
+    }
+
+    // Target not stored yet: take the first free virtual slot, or the last one
+    UINT32 slot = iter < max_iter ? iter : max_iter - 1;
+    btb.Fill(VirtualPc(InsAddr, slot), 0, Target);
+    Train(InsAddr, ghr, slot);
+}
+
+/* ===================================================================== */
+// Predictor state
 /* ===================================================================== */
 
-VOID InsCount(UINT32 c)
+SizedPredictor::SizedPredictor(UINT32 kind, UINT32 log_pht, UINT32 hist_bits, UINT32 log_bht)
+    : kind(kind), log_pht(log_pht), hist_bits(hist_bits), log_bht(log_bht), preds(0), fails(0),
+      ctr_max((kind == sweep_gag || kind == sweep_gshare) ? 7 : 3),
+      pht(1 << log_pht, 0), bht(kind == sweep_sag ? (1 << log_bht) : 0, 0)
 {
-    pre_icount = icount; 
-    icount += c;
 }
 
-INT32 FastForward(void) {
-    return ((pre_icount >= ff_cnt) && (pre_icount < ff_cnt + instrument_cnt));
+UINT64 SizedPredictor::StorageBits() const {
+    UINT64 ctr_bits = (ctr_max == 7) ? 3 : 2;
+    UINT64 bits = ctr_bits << log_pht;
+    if (kind == sweep_sag)
+        bits += (UINT64)hist_bits << log_bht;
+    else if (kind != sweep_bimodal)
+        bits += hist_bits;
+    return bits;
 }
 
-INT32 Terminate(void) {
-    return (icount >= ff_cnt + instrument_cnt);
+VOID SizedPredictor::Access(ADDRINT InsAddr, BOOL taken, UINT64 ghr) {
+    UINT32 mask = (1U << log_pht) - 1;
+    UINT32 hist_mask = (1U << hist_bits) - 1;
+    UINT32 index = 0;
+
+    switch (kind) {
+        case sweep_bimodal:
+            index = InsAddr & mask;
+            break;
+        case sweep_gag:
+            index = ghr & hist_mask & mask;
+            break;
+        case sweep_gshare:
+            index = (InsAddr ^ (ghr & hist_mask)) & mask;
+            break;
+        case sweep_sag:
+            index = bht[InsAddr & ((1U << log_bht) - 1)] & mask;
+            break;
+    }
+
+    preds++;
+    fails += ((pht[index] > ctr_max / 2) != taken);
+
+    if (taken && pht[index] < ctr_max)
+        pht[index]++;
+    else if (!taken && pht[index] > 0)
+        pht[index]--;
+
+    if (kind == sweep_sag) {
+        UINT32& local = bht[InsAddr & ((1U << log_bht) - 1)];
+        local = ((local << 1) | taken) & hist_mask;
+    }
 }
 
-VOID Fnbt(ADDRINT InsAddr, ADDRINT BranchAddr, BOOL taken) {
+PredictorSet::PredictorSet(const vector<BTB>& btbs, const RAS& ras, const ITTAGE& ittage, const VPC& vpc,
+                           const vector<SizedPredictor>& sweep)
+    : hits(predictors, vector<UINT64>(directions, 0)), misses(predictors, vector<UINT64>(directions, 0)),
+      bimod_pht(512, 0), sag_bht(1024, 0), sag_pht(512, 0), ghr(0), gag_pht(512, 0), gshare_pht(512, 0),
+      meta_gag_sag(512, 0), meta_gag_gshare(512, 0), meta_gshare_sag(512, 0),
+      btb_ghr(0), btbs(btbs), ras(ras), ittage(ittage), vpc(vpc), sweep(sweep)
+{
+}
+
+VOID PredictorSet::Fnbt(ADDRINT InsAddr, ADDRINT BranchAddr, BOOL taken) {
     if (InsAddr < BranchAddr) {
         hits[fnbt][forward] += (taken == false);
         misses[fnbt][forward] += (taken == true);
@@ -181,9 +1039,12 @@ VOID Fnbt(ADDRINT InsAddr, ADDRINT BranchAddr, BOOL taken) {
     }
 }
 
-VOID predict(ADDRINT InsAddr, ADDRINT BranchAddr, BOOL taken) {
+VOID PredictorSet::Predict(ADDRINT InsAddr, ADDRINT BranchAddr, BOOL taken) {
     UINT32 direction = BranchAddr > InsAddr ? forward : backward;
 
+    for (UINT32 i = 0; i < sweep.size(); i++)
+        sweep[i].Access(InsAddr, taken, btb_ghr);
+
     UINT32 pc = InsAddr & MASK_512; // TODO: if this is how the XOR is to be done (being used in hy1 also)
     UINT32 bht_ind = InsAddr & MASK_1024;
 
@@ -250,7 +1111,8 @@ VOID predict(ADDRINT InsAddr, ADDRINT BranchAddr, BOOL taken) {
         }
 
         ghr = ((ghr << 1) | 1) & MASK_512;
-        btb2_ghr = ((btb2_ghr << 1) | 1) & MASK_128;
+        btb_ghr = (btb_ghr << 1) | 1;
+        ittage.PushHistory(1);
     }
     else {
         hits[bimodal][direction] += (pred_bomid == false);
@@ -302,147 +1164,247 @@ VOID predict(ADDRINT InsAddr, ADDRINT BranchAddr, BOOL taken) {
         }
 
         ghr = ((ghr << 1) | 0) & MASK_512;
-        btb2_ghr = ((btb2_ghr << 1) | 0) & MASK_128;
+        btb_ghr = (btb_ghr << 1) | 0;
+        ittage.PushHistory(0);
     }
 }
 
-VOID BtbFill(ADDRINT InsAddr, ADDRINT BranchAddr, BOOL taken, UINT32 InsSize) {
-    UINT32 btb_ind = InsAddr & MASK_128;
-    ADDRINT tag = InsAddr >> 7;
-    ADDRINT next_ins = InsAddr + InsSize;
-    BOOL found = false;
-    ADDRINT target = next_ins;
-    int col_ind = 0;
-
-    for (int i = 0; i < BTB_WAYS; i++) {
-        if(btb[btb_ind][i] -> valid == 1 && btb[btb_ind][i] -> tag == tag) {
-            found = true;
-            target = btb[btb_ind][i] -> target;
-            col_ind = i;
-            break;
+VOID PredictorSet::BtbAccess(ADDRINT InsAddr, ADDRINT BranchAddr, BOOL taken, UINT32 InsSize) {
+    for (UINT32 i = 0; i < btbs.size(); i++)
+        btbs[i].Access(InsAddr, BranchAddr, taken, InsSize, btb_ghr);
+}
+
+VOID PredictorSet::IndirectPredict(ADDRINT InsAddr, ADDRINT BranchAddr) {
+    ittage.Access(InsAddr, BranchAddr);
+    vpc.Access(InsAddr, BranchAddr, btb_ghr);
+}
+
+// Sums the statistics of other into this set; table contents are not merged
+VOID PredictorSet::Merge(const PredictorSet& other) {
+    for (int i = 0; i < predictors; i++) {
+        for (int d = 0; d < directions; d++) {
+            hits[i][d] += other.hits[i][d];
+            misses[i][d] += other.misses[i][d];
         }
     }
 
-    btb_preds++;
-
-    // TODO: Won't it always be taken
-    if (taken) {
-        btb_fails += (BranchAddr != target);
+    for (UINT32 i = 0; i < btbs.size(); i++) {
+        btbs[i].preds += other.btbs[i].preds;
+        btbs[i].fails += other.btbs[i].fails;
+        btbs[i].misses += other.btbs[i].misses;
+    }
 
-        if (found && BranchAddr != target) 
-            btb[btb_ind][col_ind] -> target = BranchAddr;
+    ras.preds += other.ras.preds;
+    ras.fails += other.ras.fails;
+    ras.overflows += other.ras.overflows;
+    ras.underflows += other.ras.underflows;
 
-        if (found == false && BranchAddr != target) {
-            int insert_col = 0;
-            UINT32 lru = btb[btb_ind][0] -> lru_state;
-
-            for (int i = 0; i < BTB_WAYS; i++) {
-                if (btb[btb_ind][i] -> valid == 0) {
-                    insert_col = i;
-                    break;
-                }
-                if (lru > btb[btb_ind][i] -> lru_state) {
-                    lru = btb[btb_ind][i] -> lru_state;
-                    insert_col = i;
-                }
-            }
+    ittage.preds += other.ittage.preds;
+    ittage.fails += other.ittage.fails;
 
-            btb[btb_ind][insert_col] -> valid = 1;
-            btb[btb_ind][insert_col] -> tag = tag;
-            btb[btb_ind][insert_col] -> target = BranchAddr;
-            btb[btb_ind][insert_col] -> lru_state = lru_num ++;
-        }
+    vpc.preds += other.vpc.preds;
+    vpc.fails += other.vpc.fails;
+    vpc.iterations += other.vpc.iterations;
 
+    for (UINT32 i = 0; i < sweep.size(); i++) {
+        sweep[i].preds += other.sweep[i].preds;
+        sweep[i].fails += other.sweep[i].fails;
     }
-    else {
-        btb_fails += (target != next_ins);
-        if (found)
-            btb[btb_ind][col_ind] -> valid = 0;
-    }
+}
 
-    if (found)
-        btb[btb_ind][col_ind] -> lru_state = lru_num ++;
-    else    
-        btb_misses ++;
+/* ===================================================================== */
+// Interval time series
+/* ===================================================================== */
+
+// Misprediction counters in series column order
+static VOID CountFails(const PredictorSet& s, vector<UINT64>& fails) {
+    UINT32 c = 0;
+    for (int i = 0; i < predictors; i++)
+        fails[c++] += s.misses[i][forward] + s.misses[i][backward];
+    for (UINT32 i = 0; i < s.btbs.size(); i++)
+        fails[c++] += s.btbs[i].fails;
+    fails[c++] += s.ras.fails;
+    fails[c++] += s.ittage.fails;
+    fails[c++] += s.vpc.fails;
 }
 
-VOID Btb2Fill(ADDRINT InsAddr, ADDRINT BranchAddr, BOOL taken, UINT32 InsSize) {
-    UINT32 btb_ind = (InsAddr & MASK_128) ^ btb2_ghr;
-    ADDRINT tag = InsAddr;
-    ADDRINT next_ins = InsAddr + InsSize;
-    BOOL found = false;
-    ADDRINT target = next_ins;
-    int col_ind = 0;
-
-    for (int i = 0; i < BTB_WAYS; i++) {
-        if(btb2[btb_ind][i] -> valid == 1 && btb2[btb_ind][i] -> tag == tag) {
-            found = true;
-            target = btb2[btb_ind][i] -> target;
-            col_ind = i;
-            break;
+static VOID SeriesHeader() {
+    *series << "interval\ticount\tphase";
+    for (int i = 0; i < predictors; i++)
+        *series << "\t" << bpreds[i];
+    for (UINT32 i = 0; i < proto -> btbs.size(); i++)
+        *series << "\t" << proto -> btbs[i].name;
+    *series << "\tRAS\tITTAGE\tVPC" << endl;
+
+    prev_fails.assign(predictors + proto -> btbs.size() + 3, 0);
+}
+
+// Fixed pseudo-random projection weight in [-1, 1] for block id along dimension d
+static double Projection(UINT32 id, UINT32 d) {
+    UINT64 z = ((UINT64)id * BBV_DIMS + d + 1) * 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return (z >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+}
+
+// Nearest known phase by Manhattan distance, or a new phase past the threshold
+static UINT32 ClassifyPhase(const vector<double>& sig) {
+    INT32 best = -1;
+    double best_dist = 0;
+    for (UINT32 p = 0; p < phases.size(); p++) {
+        double dist = 0;
+        for (UINT32 d = 0; d < BBV_DIMS; d++)
+            dist += fabs(sig[d] - phases[p][d]);
+        if (best < 0 || dist < best_dist) {
+            best = p;
+            best_dist = dist;
         }
     }
 
-    btb2_preds++;
-
-    // TODO: Won't it always be taken
-    if (taken) {
-        btb2_fails += (BranchAddr != target);
+    if (best >= 0 && best_dist < phase_threshold) {
+        phase_intervals[best]++;
+        return best;
+    }
 
-        if (found && BranchAddr != target) 
-            btb2[btb_ind][col_ind] -> target = BranchAddr;
+    phases.push_back(sig);
+    phase_intervals.push_back(1);
+    return phases.size() - 1;
+}
 
-        if (found == false && BranchAddr != target) {
-            int insert_col = 0;
-            UINT32 lru = btb2[btb_ind][0] -> lru_state;
-
-            for (int i = 0; i < BTB_WAYS; i++) {
-                if (btb2[btb_ind][i] -> valid == 0) {
-                    insert_col = i;
-                    break;
-                }
-                if (lru > btb2[btb_ind][i] -> lru_state) {
-                    lru = btb2[btb_ind][i] -> lru_state;
-                    insert_col = i;
-                }
-            }
+/*!
+ * Close the current interval: project its basic block vector, assign a
+ * phase and write one row of per-predictor MPKI. Counters of other
+ * threads are read without their cooperation, so a row can be off by the
+ * branches in flight at the boundary.
+ */
+VOID Snapshot(BOOL final) {
+    PIN_GetLock(&interval_lock, PIN_ThreadId() + 1);
 
-            btb2[btb_ind][insert_col] -> valid = 1;
-            btb2[btb_ind][insert_col] -> tag = tag;
-            btb2[btb_ind][insert_col] -> target = BranchAddr;
-            btb2[btb_ind][insert_col] -> lru_state = lru_num ++;
-        }
+    // The first interval starts where the window opened, which a region-of-interest marker may move
+    if (interval_num == 0 && next_snapshot == 0) {
+        interval_start = rt_window_start;
+        next_snapshot = interval_start + interval_len;
+    }
 
+    UINT64 now = rt_icount;
+    if ((!final && now < next_snapshot) || now <= interval_start) {
+        PIN_ReleaseLock(&interval_lock);
+        return;
     }
-    else {
-        btb2_fails += (target != next_ins);
-        if (found)
-            btb2[btb_ind][col_ind] -> valid = 0;
+
+    UINT64 instrs = now - interval_start;
+    interval_start = now;
+    next_snapshot = now + interval_len;
+
+    vector<double> sig(BBV_DIMS, 0);
+    for (UINT32 i = 0; i < bbl_infos.size(); i++) {
+        UINT64 count = bbl_infos[i] -> count;
+        if (count == 0)
+            continue;
+        double weight = (double)count / instrs;
+        for (UINT32 d = 0; d < BBV_DIMS; d++)
+            sig[d] += weight * Projection(bbl_infos[i] -> id, d);
+        bbl_infos[i] -> count = 0;
     }
+    UINT32 phase = ClassifyPhase(sig);
 
-    if (found)
-        btb2[btb_ind][col_ind] -> lru_state = lru_num ++;
-    else    
-        btb2_misses ++;
+    vector<UINT64> fails(prev_fails.size(), 0);
+    for (UINT32 i = 0; i < states.size(); i++)
+        CountFails(*states[i], fails);
+
+    *series << interval_num << "\t" << now << "\t" << phase;
+    for (UINT32 i = 0; i < fails.size(); i++)
+        *series << "\t" << ((fails[i] - prev_fails[i]) * 1000.0) / instrs;
+    *series << endl;
+    prev_fails = fails;
+
+    *bbv_out << interval_num << "\t" << phase;
+    for (UINT32 d = 0; d < BBV_DIMS; d++)
+        *bbv_out << "\t" << sig[d];
+    *bbv_out << endl;
+
+    interval_num++;
+    PIN_ReleaseLock(&interval_lock);
+}
+
+/* ===================================================================== */
+// Analysis routines
+/* ===================================================================== */
+
+static inline PredictorSet* GetState(THREADID tid) {
+    return static_cast<PredictorSet*>(PIN_GetThreadData(tls_key, tid));
+}
+
+static inline VOID LockState(THREADID tid) {
+    if (shared_state)
+        PIN_GetLock(&state_lock, tid + 1);
+}
+
+static inline VOID UnlockState() {
+    if (shared_state)
+        PIN_ReleaseLock(&state_lock);
+}
+
+VOID IntervalBbl(BBL_INFO* info, UINT32 c) {
+    info -> count += c;
+    if (rt_icount >= next_snapshot)
+        Snapshot(false);
+}
+
+VOID CondBranch(THREADID tid, ADDRINT InsAddr, ADDRINT BranchAddr, BOOL taken) {
+    PredictorSet* s = GetState(tid);
+    LockState(tid);
+    s -> Fnbt(InsAddr, BranchAddr, taken);
+    s -> Predict(InsAddr, BranchAddr, taken);
+    UnlockState();
 }
 
-VOID Exit() {
+VOID BtbAccess(THREADID tid, ADDRINT InsAddr, ADDRINT BranchAddr, BOOL taken, UINT32 InsSize) {
+    PredictorSet* s = GetState(tid);
+    LockState(tid);
+    s -> BtbAccess(InsAddr, BranchAddr, taken, InsSize);
+    UnlockState();
+}
+
+VOID RasPush(THREADID tid, ADDRINT ReturnAddr) {
+    PredictorSet* s = GetState(tid);
+    LockState(tid);
+    s -> ras.Push(ReturnAddr);
+    UnlockState();
+}
+
+VOID RasPop(THREADID tid, ADDRINT BranchAddr) {
+    PredictorSet* s = GetState(tid);
+    LockState(tid);
+    s -> ras.Pop(BranchAddr);
+    UnlockState();
+}
+
+VOID IndirectPredict(THREADID tid, ADDRINT InsAddr, ADDRINT BranchAddr) {
+    PredictorSet* s = GetState(tid);
+    LockState(tid);
+    s -> IndirectPredict(InsAddr, BranchAddr);
+    UnlockState();
+}
+
+VOID PrintReport(const PredictorSet& s) {
     printer(out, "Predictor", "Total Predictions", "Misprediction Fraction (%)", "Forward Misprediction Fraction (%)",
             "Backward Mispredcition Fraction (%)");
 
     *out << endl;
 
     for (int i = 0; i < predictors; i++) {
-        UINT64 total_predictions = hits[i][0] + hits[i][1] + misses[i][0] + misses[i][1];
-        UINT64 total_mispredicts = misses[i][0] + misses[i][1];
+        UINT64 total_predictions = s.hits[i][0] + s.hits[i][1] + s.misses[i][0] + s.misses[i][1];
+        UINT64 total_mispredicts = s.misses[i][0] + s.misses[i][1];
         float total_fraction = (total_mispredicts * 100.0) / total_predictions;
 
-        UINT64 forward_predicts = hits[i][forward] + misses[i][forward];
-        UINT64 forward_mispredicts = misses[i][forward];
+        UINT64 forward_predicts = s.hits[i][forward] + s.misses[i][forward];
+        UINT64 forward_mispredicts = s.misses[i][forward];
         float forward_fraction = (forward_mispredicts * 100.0) / forward_predicts;
 
-        UINT64 backward_predicts = hits[i][backward] + misses[i][backward];
-        UINT64 backward_mispredicts = misses[i][backward];
+        UINT64 backward_predicts = s.hits[i][backward] + s.misses[i][backward];
+        UINT64 backward_mispredicts = s.misses[i][backward];
         float backward_fraction = (backward_mispredicts * 100.0) / backward_predicts;
 
         printer(out, bpreds[i], total_predictions, total_fraction, forward_fraction, backward_fraction);
@@ -455,17 +1417,110 @@ VOID Exit() {
 
     *out << endl;
 
-    float btb_mf = (btb_fails * 100.0) / btb_preds;
-    float btb_mr = (btb_misses * 100.0) / btb_preds;
-    float btb2_mf = (btb2_fails * 100.0) / btb2_preds;
-    float btb2_mr = (btb2_misses * 100.0) / btb2_preds;
+    for (UINT32 i = 0; i < s.btbs.size(); i++) {
+        float btb_mf = (s.btbs[i].fails * 100.0) / s.btbs[i].preds;
+        float btb_mr = (s.btbs[i].misses * 100.0) / s.btbs[i].preds;
+        printer2(out, s.btbs[i].name, s.btbs[i].preds, btb_mf, btb_mr);
+    }
+
+    *out << endl;
+    *out << endl;
+
+    printer2(out, "Target Predictor", "Predictions", "Misprediction Fraction (%)", "Details");
 
-    printer2(out, "BTB A", btb_preds, btb_mf, btb_mr);
-    printer2(out, "BTB B", btb2_preds, btb2_mf, btb2_mr);
+    *out << endl;
+
+    stringstream ras_name, ras_info;
+    ras_name << "RAS " << s.ras.depth << " " << ras_policy_names[s.ras.policy];
+    ras_info << "overflows " << s.ras.overflows << ", underflows " << s.ras.underflows;
+    printer2(out, ras_name.str(), s.ras.preds, (s.ras.fails * 100.0) / s.ras.preds, ras_info.str());
+
+    stringstream ittage_name, ittage_info;
+    ittage_name << "ITTAGE " << s.ittage.num_tables << "x" << (1 << s.ittage.log_entries);
+    ittage_info << "history";
+    for (UINT32 i = 0; i < s.ittage.num_tables; i++)
+        ittage_info << " " << s.ittage.hist_len[i];
+    printer2(out, ittage_name.str(), s.ittage.preds, (s.ittage.fails * 100.0) / s.ittage.preds,
+             ittage_info.str());
+
+    stringstream vpc_name, vpc_info;
+    vpc_name << "VPC " << s.vpc.max_iter;
+    vpc_info << "avg iterations " << (s.vpc.preds ? (float)s.vpc.iterations / s.vpc.preds : 0);
+    printer2(out, vpc_name.str(), s.vpc.preds, (s.vpc.fails * 100.0) / s.vpc.preds, vpc_info.str());
+
+    if (s.sweep.empty())
+        return;
+
+    *out << endl;
+    *out << endl;
+
+    printer(out, "Sweep Predictor", "Storage (bits)", "Predictions", "Misprediction Fraction (%)",
+            "History (bits)");
+
+    *out << endl;
+
+    for (UINT32 i = 0; i < s.sweep.size(); i++) {
+        const SizedPredictor& p = s.sweep[i];
+        stringstream name;
+        name << sweep_names[p.kind] << " " << (1 << p.log_pht);
+        if (p.kind == sweep_sag)
+            name << " bht " << (1 << p.log_bht);
+        printer(out, name.str(), p.StorageBits(), p.preds, (p.fails * 100.0) / p.preds,
+                (p.kind == sweep_bimodal ? 0 : p.hist_bits));
+    }
+}
+
+/*!
+ * Report the aggregate over all predictor sets, then each thread when the
+ * tables are private. The instrumentation window has closed by the time
+ * this runs, so the other threads no longer update their sets.
+ */
+VOID Exit(THREADID tid) {
+    PIN_GetLock(&state_lock, tid + 1);
+
+    RuntimeSummary(*out);
+
+    PredictorSet total(*proto);
+    for (UINT32 i = 0; i < states.size(); i++)
+        total.Merge(*states[i]);
+
+    *out << "All threads (" << (shared_state ? "shared" : "private") << " tables)" << endl << endl;
+    PrintReport(total);
+
+    if (interval_len) {
+        Snapshot(true);
+        *out << endl << endl << "Intervals: " << interval_num << ", phases: " << phases.size() << endl;
+        for (UINT32 p = 0; p < phases.size(); p++)
+            *out << "Phase " << p << ": " << phase_intervals[p] << " intervals" << endl;
+    }
+
+    if (!shared_state && states.size() > 1) {
+        for (UINT32 i = 0; i < states.size(); i++) {
+            *out << endl << endl << "Thread " << state_tids[i] << endl << endl;
+            PrintReport(*states[i]);
+        }
+    }
 
     exit(0);
 }
 
+VOID ThreadStart(THREADID tid, CONTEXT* ctxt, INT32 flags, VOID* v)
+{
+    PIN_GetLock(&state_lock, tid + 1);
+    PredictorSet* s;
+    if (shared_state) {
+        s = states[0];
+    }
+    else {
+        s = new PredictorSet(*proto);
+        states.push_back(s);
+        state_tids.push_back(tid);
+    }
+    PIN_ReleaseLock(&state_lock);
+
+    PIN_SetThreadData(tls_key, s, tid);
+}
+
 /* ===================================================================== */
 // Instrumentation callbacks
 /* ===================================================================== */
@@ -476,18 +1531,9 @@ VOID Instruction1(INS ins)
 {
     // QUESTION: Will these calls be predicated
 
-    INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)FastForward, IARG_END);
-    INS_InsertThenCall(
-        ins, IPOINT_BEFORE, (AFUNPTR)Fnbt,
-        IARG_INST_PTR,
-        IARG_BRANCH_TARGET_ADDR ,
-        IARG_BRANCH_TAKEN,
-        IARG_END
-    );
-
-    INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)FastForward, IARG_END);
-    INS_InsertThenCall(
-        ins, IPOINT_BEFORE, (AFUNPTR)predict,
+    insert_call(
+        ins, (AFUNPTR)CondBranch,
+        IARG_THREAD_ID,
         IARG_INST_PTR,
         IARG_BRANCH_TARGET_ADDR ,
         IARG_BRANCH_TAKEN,
@@ -500,9 +1546,9 @@ VOID Instruction2(INS ins)
 {
     UINT32 ins_size = INS_Size(ins);
 
-    INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)FastForward, IARG_END);
-    INS_InsertThenCall(
-        ins, IPOINT_BEFORE, (AFUNPTR)BtbFill,
+    insert_call(
+        ins, (AFUNPTR)BtbAccess,
+        IARG_THREAD_ID,
         IARG_INST_PTR,
         IARG_BRANCH_TARGET_ADDR ,
         IARG_BRANCH_TAKEN,
@@ -510,15 +1556,24 @@ VOID Instruction2(INS ins)
         IARG_END
     );
 
-    INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)FastForward, IARG_END);
-    INS_InsertThenCall(
-        ins, IPOINT_BEFORE, (AFUNPTR)Btb2Fill,
-        IARG_INST_PTR,
-        IARG_BRANCH_TARGET_ADDR ,
-        IARG_BRANCH_TAKEN,
-        IARG_UINT32, ins_size,
-        IARG_END
-    );
+    // Returns go to the RAS, other indirect jumps and calls to the target predictors
+    if (INS_IsRet(ins)) {
+        insert_call(ins, (AFUNPTR)RasPop, IARG_THREAD_ID, IARG_BRANCH_TARGET_ADDR, IARG_END);
+    }
+    else {
+        insert_call(
+            ins, (AFUNPTR)IndirectPredict,
+            IARG_THREAD_ID,
+            IARG_INST_PTR,
+            IARG_BRANCH_TARGET_ADDR,
+            IARG_END
+        );
+    }
+}
+
+VOID Instruction3(INS ins)
+{
+    insert_call(ins, (AFUNPTR)RasPush, IARG_THREAD_ID, IARG_ADDRINT, INS_NextAddress(ins), IARG_END);
 }
 
 /*!
@@ -534,11 +1589,24 @@ VOID Trace(TRACE trace, VOID* v)
     // Visit every basic block in the trace
     for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
     {
-        BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)Terminate, IARG_END);
-        BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)Exit, IARG_END);
+        // Markers, block count and the terminate check; nothing else while fast-forwarding
+        if (RuntimeInstrumentBbl(bbl))
+            continue;
+
+        // Per-block counts for the interval basic block vectors
+        if (interval_len) {
+            PIN_GetLock(&interval_lock, PIN_ThreadId() + 1);
+            BBL_INFO*& info = bbl_map[BBL_Address(bbl)];
+            if (info == NULL) {
+                info = new BBL_INFO;
+                info -> count = 0;
+                info -> id = bbl_infos.size();
+                bbl_infos.push_back(info);
+            }
+            PIN_ReleaseLock(&interval_lock);
 
-        // Insert a call to CountBbl() before every basic bloc, passing the number of instructions
-        BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)InsCount, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+            insert_bbl_call(bbl, (AFUNPTR)IntervalBbl, IARG_PTR, info, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+        }
 
         BOOL break_flag = 1;
         for (INS ins = BBL_InsHead(bbl); break_flag && INS_Valid(ins); ins = INS_Next(ins)) 
@@ -548,12 +1616,12 @@ VOID Trace(TRACE trace, VOID* v)
                 Instruction1(ins);
             else if (INS_IsIndirectControlFlow(ins)) 
                 Instruction2(ins);
+            if (INS_IsCall(ins))
+                Instruction3(ins);
         }
     }
 }
 
-// TODO: there was an instruction to increase the number of threads. See if useful
-
 /*!
  * Print out analysis results.
  * This function is called when the application exits.
@@ -564,7 +1632,7 @@ VOID Trace(TRACE trace, VOID* v)
 VOID Fini(INT32 code, VOID* v)
 {
     *out << "Finished Binary" << endl;
-    *out << "Instruction number: " << icount << endl;
+    RuntimeSummary(*out);
 }
 
 /*!
@@ -585,63 +1653,106 @@ int main(int argc, char* argv[])
 
     string fileName = KnobOutputFile.Value();
 
-    if (!fileName.empty())
-    {
-        out = new std::ofstream(fileName.c_str());
+    out = RuntimeOpenOutput(fileName);
+
+    RuntimeInit(KnobFastForward * FF_MUL, instrument_cnt, (AFUNPTR)Exit);
+
+    // BTB A and BTB B from the assignment, followed by any -btb geometries
+    vector<BTB> btbs;
+    btbs.push_back(BTB("BTB A", BTB_SETS, BTB_WAYS, 0, btb_lru, btb_index_pc));
+    btbs.push_back(BTB("BTB B", BTB_SETS, BTB_WAYS, 0, btb_lru, btb_index_ghr));
+
+    for (UINT32 i = 0; i < KnobBtb.NumberOfValues(); i++) {
+        if (KnobBtb.Value(i).empty())
+            continue;
+        BTB* b = ParseBtb(KnobBtb.Value(i));
+        if (b == NULL) {
+            cerr << "Invalid BTB configuration: " << KnobBtb.Value(i) << endl;
+            return Usage();
+        }
+        btbs.push_back(*b);
+        delete b;
     }
 
-    ff_cnt = KnobFastForward * FF_MUL;
-    for (int i = 0; i < predictors; i++) {
-        vector<UINT64> v1(2, 0);
-        vector<UINT64> v2(2, 0);
-        hits.push_back(v1);
-        misses.push_back(v2);
-    }
-
-    for (int i = 0; i < BTB_SETS; i++) {
-        vector<BTB_ENTRY*> v1;
-        for (int j = 0; j < BTB_WAYS; j++) {
-            BTB_ENTRY* entry = new BTB_ENTRY;
-            entry -> valid = 0;
-            entry -> tag = 0;
-            entry -> lru_state = 0;
-            entry -> target = 0;
-            v1.push_back(entry);
+    INT32 ras_policy = FindName(ras_policy_names, KnobRasOverflow.Value());
+    if (KnobRasDepth.Value() == 0 || ras_policy < 0) {
+        cerr << "Invalid RAS configuration" << endl;
+        return Usage();
+    }
+
+    UINT32 ittage_tables = KnobIttageTables.Value();
+    UINT32 ittage_log = KnobIttageLogEntries.Value();
+    UINT32 min_hist = KnobIttageMinHist.Value();
+    UINT32 max_hist = KnobIttageMaxHist.Value();
+    if (ittage_tables == 0 || ittage_tables > ITTAGE_MAX_TABLES || ittage_log == 0 || ittage_log > 20 ||
+        min_hist == 0 || min_hist > max_hist || max_hist >= ITTAGE_HIST_BITS) {
+        cerr << "Invalid ITTAGE configuration" << endl;
+        return Usage();
+    }
+
+    if (KnobVpcIter.Value() == 0 || KnobVpcIter.Value() > VPC_MAX_ITER) {
+        cerr << "Invalid VPC configuration" << endl;
+        return Usage();
+    }
+
+    // Storage sweep: every table size, and every history length that fits it
+    vector<SizedPredictor> sweep;
+    if (!KnobSweepSizes.Value().empty()) {
+        vector<UINT32> sizes, hists;
+        UINT32 log_bht = KnobSweepBht.Value();
+        if (!ParseList(KnobSweepSizes.Value(), sizes) || !ParseList(KnobSweepHist.Value(), hists) ||
+            log_bht == 0 || log_bht > 20) {
+            cerr << "Invalid sweep configuration" << endl;
+            return Usage();
         }
-        btb.push_back(v1);
-    }
-
-     for (int i = 0; i < BTB_SETS; i++) {
-        vector<BTB_ENTRY*> v1;
-        for (int j = 0; j < BTB_WAYS; j++) {
-            BTB_ENTRY* entry = new BTB_ENTRY;
-            entry -> valid = 0;
-            entry -> tag = 0;
-            entry -> lru_state = 0;
-            entry -> target = 0;
-            v1.push_back(entry);
+        for (UINT32 i = 0; i < sizes.size(); i++) {
+            if (sizes[i] == 0 || sizes[i] > 24) {
+                cerr << "Invalid sweep table size: " << sizes[i] << endl;
+                return Usage();
+            }
+            sweep.push_back(SizedPredictor(sweep_bimodal, sizes[i], 0, 0));
+            sweep.push_back(SizedPredictor(sweep_gag, sizes[i], sizes[i], 0));
+            for (UINT32 j = 0; j < hists.size(); j++) {
+                if (hists[j] == 0 || hists[j] > sizes[i])
+                    continue;
+                sweep.push_back(SizedPredictor(sweep_gshare, sizes[i], hists[j], 0));
+                sweep.push_back(SizedPredictor(sweep_sag, sizes[i], hists[j], log_bht));
+            }
         }
-        btb2.push_back(v1);
     }
 
+    proto = new PredictorSet(btbs, RAS(KnobRasDepth.Value(), ras_policy),
+                             ITTAGE(ittage_tables, ittage_log, min_hist, max_hist),
+                             VPC(KnobVpcIter.Value(), 12), sweep);
+
+    // Threads get their own copy of the prototype unless -shared is given
+    PIN_InitLock(&state_lock);
+    tls_key = PIN_CreateThreadDataKey(NULL);
+    shared_state = KnobShared.Value();
+    if (shared_state) {
+        states.push_back(new PredictorSet(*proto));
+        state_tids.push_back(0);
+    }
 
-    cerr << "Fast Forward amount :" << ff_cnt << endl;
-    cerr << "Output File name :" << fileName << endl;
-    cerr << "Cutoff Point :" << ff_cnt + instrument_cnt << endl;
+    interval_len = KnobInterval.Value();
+    if (interval_len) {
+        PIN_InitLock(&interval_lock);
+        phase_threshold = KnobPhaseThreshold.Value();
+        series = new std::ofstream(KnobSeriesFile.Value().c_str());
+        bbv_out = new std::ofstream(KnobBbvFile.Value().c_str());
+        SeriesHeader();
+    }
 
     // Register function to be called to instrument traces
     TRACE_AddInstrumentFunction(Trace, 0);
 
+    // Register function to be called when a thread starts
+    PIN_AddThreadStartFunction(ThreadStart, 0);
+
     // Register function to be called when the application exits
     PIN_AddFiniFunction(Fini, 0);
 
-    cerr << "===============================================" << endl;
-    cerr << "This application is instrumented by HW1" << endl;
-    if (!KnobOutputFile.Value().empty())
-    {
-        cerr << "See file " << KnobOutputFile.Value() << " for analysis results" << endl;
-    }
-    cerr << "===============================================" << endl;
+    RuntimeBanner("HW2", KnobOutputFile.Value());
 
     // Start the program, never returns
     PIN_StartProgram();
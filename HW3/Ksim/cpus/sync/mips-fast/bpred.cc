@@ -0,0 +1,121 @@
+#include "bpred.h"
+#include <string.h>
+
+BranchPredictor::BranchPredictor (char *kind, unsigned int entries,
+                                  unsigned int btbEntries, unsigned int historyBits)
+{
+   unsigned int i;
+
+   if (!strcmp (kind, "perfect"))
+      _kind = BP_PERFECT;
+   else if (!strcmp (kind, "nottaken"))
+      _kind = BP_NOTTAKEN;
+   else if (!strcmp (kind, "bimodal"))
+      _kind = BP_BIMODAL;
+   else if (!strcmp (kind, "gshare"))
+      _kind = BP_GSHARE;
+   else
+      fatal_error ("Unknown Mipc.BranchPredictor `%s'", kind);
+   _name = kind;
+
+   if (!entries || (entries & (entries - 1)))
+      fatal_error ("Mipc.BPredEntries must be a power of two, got %u", entries);
+   if (!btbEntries || (btbEntries & (btbEntries - 1)))
+      fatal_error ("Mipc.BTBEntries must be a power of two, got %u", btbEntries);
+
+   _pht = new unsigned char[entries];
+   for (i = 0; i < entries; i++)
+      _pht[i] = 1;			// weakly not taken
+   _phtMask = entries - 1;
+   _history = 0;
+   _historyMask = historyBits >= 32 ? ~0U : (1U << historyBits) - 1;
+
+   _btb = new BTBEntry[btbEntries];
+   for (i = 0; i < btbEntries; i++)
+      _btb[i]._valid = FALSE;
+   _btbMask = btbEntries - 1;
+
+   _lookups = 0;
+   _btbHits = 0;
+}
+
+BranchPredictor::~BranchPredictor (void)
+{
+   delete [] _pht;
+   delete [] _btb;
+}
+
+Bool
+BranchPredictor::IsUncond (unsigned int ins)
+{
+   unsigned int op = ins >> 26;
+
+   if (op == 0)
+      return (ins & 0x3f) == 8 || (ins & 0x3f) == 9;
+   return op == 2 || op == 3;
+}
+
+unsigned int
+BranchPredictor::Index (unsigned int pc)
+{
+   if (_kind == BP_GSHARE)
+      return ((pc >> 2) ^ _history) & _phtMask;
+   return (pc >> 2) & _phtMask;
+}
+
+/*
+ * Only branches that have been taken are in the BTB, so a miss is a
+ * fall-through prediction whatever the counters say.
+ */
+Bool
+BranchPredictor::Predict (unsigned int pc, unsigned int *target)
+{
+   BTBEntry *e;
+
+   if (_kind == BP_PERFECT || _kind == BP_NOTTAKEN)
+      return FALSE;
+
+   _lookups++;
+   e = &_btb[(pc >> 2) & _btbMask];
+   if (!e->_valid || e->_pc != pc)
+      return FALSE;
+   _btbHits++;
+
+   if (!e->_uncond && _pht[Index (pc)] < 2)
+      return FALSE;
+   *target = e->_target;
+   return TRUE;
+}
+
+/*
+ * History is updated at resolution, not speculatively at fetch. With a
+ * single delay slot a branch resolves before the next one is fetched,
+ * so Predict and Update see the same history.
+ */
+void
+BranchPredictor::Update (unsigned int pc, unsigned int ins, Bool taken, unsigned int target)
+{
+   BTBEntry *e;
+   unsigned char *c;
+   Bool uncond = IsUncond (ins);
+
+   if (_kind == BP_PERFECT || _kind == BP_NOTTAKEN)
+      return;
+
+   if (!uncond) {
+      c = &_pht[Index (pc)];
+      if (taken && *c < 3)
+         (*c)++;
+      else if (!taken && *c > 0)
+         (*c)--;
+      _history = ((_history << 1) | (taken ? 1 : 0)) & _historyMask;
+   }
+
+   if (taken) {
+      e = &_btb[(pc >> 2) & _btbMask];
+      e->_valid = TRUE;
+      e->_uncond = uncond;
+      e->_pc = pc;
+      e->_target = target;
+   }
+}
@@ -0,0 +1,51 @@
+#ifndef __BPRED_H__
+#define __BPRED_H__
+
+#include "mips.h"
+
+/* predictor kinds, Mipc.BranchPredictor = perfect|nottaken|bimodal|gshare */
+#define BP_PERFECT	0		// no penalty: resolution redirects fetch in time
+#define BP_NOTTAKEN	1		// always fall through
+#define BP_BIMODAL	2		// 2-bit counters indexed by PC
+#define BP_GSHARE	3		// 2-bit counters indexed by PC xor global history
+
+class BranchPredictor {
+public:
+   BranchPredictor (char *kind, unsigned int entries, unsigned int btbEntries,
+                    unsigned int historyBits);
+   ~BranchPredictor ();
+
+   Bool Predict (unsigned int pc, unsigned int *target);
+				// Fetch-time lookup: TRUE and the target if
+				// "pc" is a branch predicted taken
+   void Update (unsigned int pc, unsigned int ins, Bool taken, unsigned int target);
+				// Resolution of the branch "ins" at "pc"
+
+   static Bool IsUncond (unsigned int ins);	// j, jal, jr, jalr
+
+   int _kind;
+   char *_name;
+
+   /* direction: 2-bit saturating counters, taken when >= 2 */
+   unsigned char *_pht;
+   unsigned int _phtMask;
+   unsigned int _history;
+   unsigned int _historyMask;
+
+   /* branch target buffer, direct-mapped, filled by taken branches */
+   class BTBEntry {
+   public:
+      Bool _valid;
+      Bool _uncond;
+      unsigned int _pc;
+      unsigned int _target;
+   } *_btb;
+   unsigned int _btbMask;
+
+   LL _lookups;
+   LL _btbHits;
+
+private:
+   unsigned int Index (unsigned int pc);
+};
+#endif
@@ -1,11 +1,6 @@
 #include "pipeline.h"
 #include "decode.h"
 
-DecodeExec::DecodeExec(FetchDecode *fd) 
-{
-   _ins = fd->_ins;
-   _pc = fd->_pc;
-}
 DecodeExec::DecodeExec(void) 
 {
    _ins = 0;
@@ -34,12 +29,21 @@ DecodeExec::DecodeExec(void)
    _sreg1 = 0;
    _sreg2 = 0;
    _freg = 0;
+   _readFreg = FALSE;
+   _regTarget = FALSE;
 
    _opControl = NULL;
    _memOp = NULL;
 }
 DecodeExec::~DecodeExec (void) {}
 
+void
+DecodeExec::Latch(FetchDecode *fd)
+{
+   _ins = fd->_ins;
+   _pc = fd->_pc;
+}
+
 void 
 DecodeExec::copy(DecodeExec *de) 
 {
@@ -50,6 +54,7 @@ DecodeExec::copy(DecodeExec *de)
 Decode::Decode (Mipc *mc)
 {
    _mc = mc;
+   _stall = FALSE;
 }
 
 Decode::~Decode (void) {}
@@ -57,79 +62,95 @@ Decode::~Decode (void) {}
 void
 Decode::MainLoop (void)
 {
-   unsigned int ins;
-
    while (1) {
       AWAIT_P_PHI0;	// @posedge
-      if (_mc->_interlock)
-      {
-         _mc->_pc = _mc->_fd->_pc;
+      Posedge ();
+      AWAIT_P_PHI1;	// @negedge
+      Negedge ();
+   }
+}
+
+void
+Decode::Posedge (void)
+{
+   if (_mc->_interlock)
+   {
+      _mc->_pc = _mc->_fd->_pc;
+      if (!_mc->_fd->_bubble)
          _mc->_nfetched --;
-         _mc->_load_stall ++;
-         _mc->_fd->_ins = _mc->_de->_prevIns;
-         _mc->_fd->_pc = _mc->_de->_prevPc;
-      }
-      DecodeExec *de = new DecodeExec(_mc->_fd);
-      Bool stall = _mc->_stallDec;
-      if (_mc->_isSyscall) {
-         _mc->_pc = _mc->_fd->_pc;
-         _mc->_fd->_ins = 0;    // TODO: Check if this is what was meant by nullifying the instructions
+      _mc->_load_stall ++;
+      _mc->_fd->_ins = _mc->_de->_prevIns;
+      _mc->_fd->_pc = _mc->_de->_prevPc;
+      _mc->_fd->_bubble = FALSE;
+   }
+   DecodeExec *de = _mc->_deNext;
+   de->Latch(_mc->_fd);
+   _stall = _mc->_stallDec;
+   if (_mc->_isSyscall) {
+      _mc->_pc = _mc->_fd->_pc;
+      _mc->_fd->_ins = 0;    // TODO: Check if this is what was meant by nullifying the instructions
+      if (!_mc->_fd->_bubble)
          _mc->_nfetched -= 1;
-         _mc->_isSyscall = FALSE;
-      }
-      for (int i=0; i < 34; i++) {
-         if (_mc->_gprCycles[i] != 0)
-            _mc->_gprCycles[i] --;
-      }
-      for (int i=0; i < 16; i++) {
-         if (_mc->_fprCycles[i] != 0)
-            _mc->_fprCycles[i] --;
-      }
+      _mc->_fd->_bubble = TRUE;
+      _mc->_isSyscall = FALSE;
+   }
+}
 
-      AWAIT_P_PHI1;	// @negedge
-      if (!stall) {
-         _mc->_de->copy(de);
-         _mc->_de->_bd = 0;
-         _mc->_de->_sreg1 = _mc->_de->_sreg2 = _mc->_de->_freg = 0;
-         _mc->_dcyc = 0;
-         _mc->_interlock = FALSE;
-         _mc->_de->Dec(_mc, _mc->_em, _mc->_mw, _mc->_de->_ins);
+/*
+ * The instruction just decoded enters EX at the next @posedge, while the
+ * one in EX/MEM is still a cycle from memory. Every other operand is on
+ * a bypass path by the time it is read (see Mipc::BypassGpr), so this
+ * load-use case is the only one that stalls. Store data is read in MEM
+ * and never waits.
+ */
+Bool
+Decode::LoadUse (void)
+{
+   ExecMem *ld = _mc->_em;
+   DecodeExec *de = _mc->_de;
 
-         if(_mc->_de->_isSyscall) {
-            _mc->_stallFetch = TRUE;
-            _mc->_stallDec = TRUE;
-            _mc->_isSyscall = TRUE;
-         }
-         else if ((_mc->_de->_sreg1 != 0 && _mc->_gprCycles[_mc->_de->_sreg1] > _mc->_scyc1)
-                  || (_mc->_de->_sreg2 != 0 && _mc->_gprCycles[_mc->_de->_sreg2] > _mc->_scyc2) 
-                  || (_mc->_de->_freg != 0 && _mc->_fprCycles[_mc->_de->_freg] > _mc->_fcyc))
-         {
-            _mc->_de->_prevIns = _mc->_de->_ins;
-            _mc->_de->_prevPc = _mc->_de->_pc;
-            _mc->_interlock = TRUE;
-            _mc->_de->_ins = 0;
-            _mc->_de->_bd = 0;
-            _mc->_de->Dec(_mc, _mc->_em, _mc->_mw, _mc->_de->_ins);
-         }
-         else if (!_mc->_de->_isIllegalOp) {
-            if (_mc->_de->_writeREG && _mc->_de->_decodedDST != 0)
-               _mc->_gprCycles[_mc->_de->_decodedDST] = _mc->_dcyc;
-            else if (_mc->_de->_writeFREG)
-               _mc->_fprCycles[(_mc->_de->_decodedDST)>>1] = _mc->_dcyc;
-            else if (_mc->_de->_loWPort)
-               _mc->_gprCycles[LO] = _mc->_dcyc;
-            else if (_mc->_de->_hiWPort)
-               _mc->_gprCycles[HI] = _mc->_dcyc;
-         }
+   if (!ld->_memControl || ld->_isSyscall || ld->_isIllegalOp)
+      return FALSE;
+   if (ld->_writeREG && ld->_decodedDST != 0)
+      return de->_sreg1 == ld->_decodedDST
+             || (!de->_memControl && de->_sreg2 == ld->_decodedDST);
+   if (ld->_writeFREG)
+      return !de->_memControl && de->_readFreg && de->_freg == ld->_decodedDST;
+   return FALSE;
+}
+
+void
+Decode::Negedge (void)
+{
+   if (!_stall) {
+      _mc->_de->copy(_mc->_deNext);
+      _mc->_de->_bd = 0;
+      _mc->_de->_sreg1 = _mc->_de->_sreg2 = _mc->_de->_freg = 0;
+      _mc->_interlock = FALSE;
+      _mc->_de->CachedDec(_mc, _mc->_em, _mc->_mw, _mc->_de->_ins);
+
+      if(_mc->_de->_isSyscall) {
+         _mc->_stallFetch = TRUE;
+         _mc->_stallDec = TRUE;
+         _mc->_isSyscall = TRUE;
       }
-      else {
+      else if (LoadUse ())
+      {
+         _mc->_de->_prevIns = _mc->_de->_ins;
+         _mc->_de->_prevPc = _mc->_de->_pc;
+         _mc->_interlock = TRUE;
          _mc->_de->_ins = 0;
          _mc->_de->_bd = 0;
-         _mc->_de->Dec(_mc, _mc->_em, _mc->_mw, _mc->_de->_ins);
+         _mc->_de->CachedDec(_mc, _mc->_em, _mc->_mw, _mc->_de->_ins);
       }
+   }
+   else {
+      _mc->_de->_ins = 0;
+      _mc->_de->_bd = 0;
+      _mc->_de->CachedDec(_mc, _mc->_em, _mc->_mw, _mc->_de->_ins);
+   }
 #ifdef MIPC_DEBUG
-      fprintf(_mc->_debugLog, "<%llu> Decoded ins %#x\n", SIM_TIME, _mc->_de->_ins);
-      fflush(_mc->_debugLog);
+   fprintf(_mc->_debugLog, "<%llu> Decoded ins %#x\n", SIM_TIME, _mc->_de->_ins);
+   fflush(_mc->_debugLog);
 #endif
-   }
 }
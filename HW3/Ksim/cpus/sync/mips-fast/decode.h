@@ -12,6 +12,11 @@ public:
   
    FAKE_SIM_TEMPLATE;
 
+   void Posedge (void);		// Work done @posedge
+   void Negedge (void);		// Work done @negedge
+   Bool LoadUse (void);		// Decoded ins needs a load's result in EX too soon
+
    Mipc *_mc;
+   Bool _stall;			// _stallDec sampled @posedge
 };
 #endif
@@ -25,6 +25,8 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
 
    _isIllegalOp = FALSE;
    _isSyscall = FALSE;
+   _readFreg = FALSE;
+   _regTarget = FALSE;
 
    i.data = ins;
   
@@ -44,8 +46,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _memControl = FALSE;
       _sreg1 = i.reg.rs;
       _sreg2 = i.reg.rt;
-      _mc->_scyc1 = _mc->_scyc2 = 1;
-      _mc->_dcyc = 2;
 
       switch (i.reg.func) {
       case 0x20:			// add
@@ -169,6 +169,7 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       case 9:			// jalr
          _opControl = _em->func_jalr;
          _btgt = _decodedSRC1;
+         _regTarget = TRUE;
          _bd = 1;
          break;
 
@@ -177,6 +178,7 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
          _writeREG = FALSE;
          _writeFREG = FALSE;
          _btgt = _decodedSRC1;
+         _regTarget = TRUE;
          _bd = 1;
 	 break;
 
@@ -214,8 +216,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _loWPort = FALSE;
       _memControl = FALSE;
       _sreg1 = i.imm.rs;
-      _mc->_scyc1 = 1;
-      _mc->_dcyc = 2;
       break;
 
    case 0xc:			// andi
@@ -229,8 +229,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _loWPort = FALSE;
       _memControl = FALSE;
       _sreg1 = i.imm.rs;
-      _mc->_scyc1 = 1;
-      _mc->_dcyc = 2;
       break;
 
    case 0xf:			// lui
@@ -242,7 +240,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _hiWPort = FALSE;
       _loWPort = FALSE;
       _memControl = FALSE;
-      _mc->_dcyc = 2;
       break;
 
    case 0xd:			// ori
@@ -256,8 +253,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _loWPort = FALSE;
       _memControl = FALSE;
       _sreg1 = i.imm.rs;
-      _mc->_scyc1 = 1;
-      _mc->_dcyc = 2;
       break;
 
    case 0xa:			// slti
@@ -271,8 +266,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _loWPort = FALSE;
       _memControl = FALSE;
       _sreg1 = i.imm.rs;
-      _mc->_scyc1 = 1;
-      _mc->_dcyc = 2;
       break;
 
    case 0xb:			// sltiu
@@ -286,8 +279,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _loWPort = FALSE;
       _memControl = FALSE;
       _sreg1 = i.imm.rs;
-      _mc->_scyc1 = 1;
-      _mc->_dcyc = 2;
       break;
 
    case 0xe:			// xori
@@ -301,8 +292,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _loWPort = FALSE;
       _memControl = FALSE;
       _sreg1 = i.imm.rs;
-      _mc->_scyc1 = 1;
-      _mc->_dcyc = 2;
       break;
 
    case 4:			// beq
@@ -318,8 +307,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _branchOffset <<= 16; _branchOffset >>= 14; _bd = 1; _btgt = (unsigned)((signed)_pc+_branchOffset+4);
       _sreg1 = i.imm.rs;
       _sreg2 = i.imm.rt;
-      _mc->_scyc1 = _mc->_scyc2 = 1;
-      _mc->_dcyc = 2;
       break;
 
    case 1:
@@ -332,7 +319,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _loWPort = FALSE;
       _memControl = FALSE;
       _sreg1 = i.reg.rs;
-      _mc->_scyc1 = 1;
 
       switch (i.reg.rt) {
       case 1:			// bgez
@@ -345,7 +331,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
          _decodedDST = 31;
          _writeREG = TRUE;
          _branchOffset <<= 16; _branchOffset >>= 14; _bd = 1; _btgt = (unsigned)((signed)_pc+_branchOffset+4);
-         _mc->_dcyc = 2;
 	 break;
 
       case 0x10:			// bltzal
@@ -353,7 +338,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
          _decodedDST = 31;
          _writeREG = TRUE;
          _branchOffset <<= 16; _branchOffset >>= 14; _bd = 1; _btgt = (unsigned)((signed)_pc+_branchOffset+4);
-         _mc->_dcyc = 2;
 	 break;
 
       case 0x0:			// bltz
@@ -378,7 +362,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _memControl = FALSE;
       _branchOffset <<= 16; _branchOffset >>= 14; _bd = 1; _btgt = (unsigned)((signed)_pc+_branchOffset+4);
       _sreg1 = i.reg.rs;
-      _mc->_scyc1 = 1;
       break;
 
    case 6:			// blez
@@ -392,7 +375,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _memControl = FALSE;
       _branchOffset <<= 16; _branchOffset >>= 14; _bd = 1; _btgt = (unsigned)((signed)_pc+_branchOffset+4);
       _sreg1 = i.reg.rs;
-      _mc->_scyc1 = 1;
       break;
 
    case 5:			// bne
@@ -408,7 +390,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _branchOffset <<= 16; _branchOffset >>= 14; _bd = 1; _btgt = (unsigned)((signed)_pc+_branchOffset+4);
       _sreg1 = i.reg.rs;
       _sreg2 = i.reg.rt;
-      _mc->_scyc1 = _mc->_scyc2 = 1;
       break;
 
    case 2:			// j
@@ -432,7 +413,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _loWPort = FALSE;
       _memControl = FALSE;
       _btgt = ((_pc+4) & 0xf0000000) | (_branchOffset<<2); _bd = 1;
-      _mc->_dcyc = 2;
       break;
 
    case 0x20:			// lb  
@@ -447,8 +427,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _loWPort = FALSE;
       _memControl = TRUE;
       _sreg1 = i.reg.rs;
-      _mc->_scyc1 = 1;
-      _mc->_dcyc = 3;
       break;
 
    case 0x24:			// lbu
@@ -463,8 +441,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _loWPort = FALSE;
       _memControl = TRUE;
       _sreg1 = i.reg.rs;
-      _mc->_scyc1 = 1;
-      _mc->_dcyc = 3;
       break;
 
    case 0x21:			// lh
@@ -479,8 +455,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _loWPort = FALSE;
       _memControl = TRUE;
       _sreg1 = i.reg.rs;
-      _mc->_scyc1 = 1;
-      _mc->_dcyc = 3;
       break;
 
    case 0x25:			// lhu
@@ -495,8 +469,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _loWPort = FALSE;
       _memControl = TRUE;
       _sreg1 = i.reg.rs;
-      _mc->_scyc1 = 1;
-      _mc->_dcyc = 3;
       break;
 
    case 0x22:			// lwl
@@ -513,9 +485,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _memControl = TRUE;
       _sreg1 = i.reg.rs;
       _sreg2 = i.reg.rt;
-      _mc->_scyc1 = 1;
-      _mc->_scyc2 = 2;
-      _mc->_dcyc = 3;
       break;
 
    case 0x23:			// lw
@@ -530,8 +499,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _loWPort = FALSE;
       _memControl = TRUE;
       _sreg1 = i.reg.rs;
-      _mc->_scyc1 = 1;
-      _mc->_dcyc = 3;
       break;
 
    case 0x26:			// lwr
@@ -548,9 +515,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _memControl = TRUE;
       _sreg1 = i.reg.rs;
       _sreg2 = i.reg.rt;
-      _mc->_scyc1 = 1;
-      _mc->_scyc2 = 2;
-      _mc->_dcyc = 3;
       break;
 
    case 0x31:			// lwc1
@@ -565,8 +529,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _loWPort = FALSE;
       _memControl = TRUE;
       _sreg1 = i.reg.rs;
-      _mc->_scyc1 = 1;
-      _mc->_dcyc = 3;
       break;
 
    case 0x39:			// swc1
@@ -583,8 +545,7 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _memControl = TRUE;
       _sreg1 = i.reg.rs;
       _freg = i.reg.rt;
-      _mc->_scyc1 = 1;
-      _mc->_fcyc = 2;
+      _readFreg = TRUE;
       break;
 
    case 0x28:			// sb
@@ -601,8 +562,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _memControl = TRUE;
       _sreg1 = i.reg.rs;
       _sreg2 = i.reg.rt;
-      _mc->_scyc1 = 1;
-      _mc->_scyc2 = 2;
       break;
 
    case 0x29:			// sh  store half word
@@ -619,8 +578,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _memControl = TRUE;
       _sreg1 = i.reg.rs;
       _sreg2 = i.reg.rt;
-      _mc->_scyc1 = 1;
-      _mc->_scyc2 = 2;
       break;
 
    case 0x2a:			// swl
@@ -637,8 +594,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _memControl = TRUE;
       _sreg1 = i.reg.rs;
       _sreg2 = i.reg.rt;
-      _mc->_scyc1 = 1;
-      _mc->_scyc2 = 2;
       break;
 
    case 0x2b:			// sw
@@ -655,8 +610,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _memControl = TRUE;
       _sreg1 = i.reg.rs;
       _sreg2 = i.reg.rt;
-      _mc->_scyc1 = 1;
-      _mc->_scyc2 = 2;
       break;
 
    case 0x2e:			// swr
@@ -673,8 +626,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
       _memControl = TRUE;
       _sreg1 = i.reg.rs;
       _sreg2 = i.reg.rt;
-      _mc->_scyc1 = 1;
-      _mc->_scyc2 = 2;
       break;
 
    case 0x11:			// floating-point
@@ -690,8 +641,6 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
          _loWPort = FALSE;
          _memControl = FALSE;
          _sreg1 = i.freg.ft;   //TODO: Change this in previous implementation as well
-         _mc->_scyc1 = 1;
-         _mc->_dcyc = 2;
 	 break;
 
       case 0:			// mfc1
@@ -703,9 +652,8 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
          _hiWPort = FALSE;
          _loWPort = FALSE;
          _memControl = FALSE;
-         _freg = i.freg.ft;
-         _mc->_fcyc = 1;
-         _mc->_dcyc = 2;
+         _freg = i.freg.fs;
+         _readFreg = TRUE;
 	 break;
       default:
          _isIllegalOp = TRUE;
@@ -728,6 +676,86 @@ DecodeExec::Dec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
    }
 }
 
+/*------------------------------------------------------------------------
+ *
+ *  Decode cache
+ *
+ *   Dec() reads register values and otherwise depends only on the
+ *   instruction word and its PC, so a hit restores the latch Dec() left
+ *   and repeats just its side effects on Mipc and its register reads,
+ *   taken from the source register numbers Dec() recorded.
+ *   The tag holds the word itself, so code that is overwritten simply
+ *   misses.
+ *
+ *------------------------------------------------------------------------
+ */
+void
+DecodeExec::CachedDec (Mipc *_mc, ExecMem *_em, MemWb *_mw, unsigned int ins)
+{
+   // Bubbles share the PC of the instruction they replace, keep them out
+   if (!_mc->_decodeCache || ins == 0) {
+      Dec (_mc, _em, _mw, ins);
+      return;
+   }
+
+   DecodedIns *d = &_mc->_decodeCache[(_pc >> 2) & _mc->_decodeCacheMask];
+   if (d->_valid && d->_pc == _pc && d->_ins == ins) {
+      unsigned int prevIns = _prevIns, prevPc = _prevPc;
+      *this = d->_de;
+      _prevIns = prevIns;
+      _prevPc = prevPc;
+
+      if ((ins >> 26) == 0x11)
+         _mc->_fpinst++;
+
+      ReadOperands (_mc);
+      _mc->_decodeHits++;
+      return;
+   }
+
+   Dec (_mc, _em, _mw, ins);
+
+   d->_valid = TRUE;
+   d->_pc = _pc;
+   d->_ins = ins;
+   d->_de = *this;
+   _mc->_decodeMisses++;
+}
+
+/*
+ * Re-read the sources Dec() named in _sreg1/_sreg2/_freg. _sreg1 is
+ * HI or LO for mfhi/mflo, which Dec() does not read through the gpr.
+ */
+void
+DecodeExec::ReadOperands (Mipc *_mc)
+{
+   unsigned int v;
+
+   if (_sreg1 != 0 && _sreg1 < 32)
+      _decodedSRC1 = _mc->_gpr[_sreg1];
+
+   if (_sreg2 != 0) {
+      v = _mc->_gpr[_sreg2];
+      if (!_memControl)
+         _decodedSRC2 = v;
+      else if (_writeREG)		// lwl, lwr
+         _subregOperand = v;
+      else
+         _decodedSRC3 = v;
+   }
+
+   if (_readFreg) {
+      v = _mc->_fpr[_freg>>1].l[FP_TWIDDLE^(_freg&1)];
+      if (_memControl)			// swc1
+         _decodedSRC3 = v;
+      else				// mfc1
+         _decodedSRC1 = v;
+   }
+
+   if (_regTarget)
+      _btgt = _decodedSRC1;
+}
+
 
 /*
  *
@@ -1,7 +1,9 @@
 #include "pipeline.h"
 #include "executor.h"
+#include "bpred.h"
 
-ExecMem::ExecMem (DecodeExec *de) 
+void
+ExecMem::Latch (DecodeExec *de) 
 {
    _ins = de->_ins;
    _pc = de->_pc;
@@ -27,6 +29,7 @@ ExecMem::ExecMem (DecodeExec *de)
 
    _sreg2 = de->_sreg2;
    _freg = de->_freg;
+   _readFreg = de->_readFreg;
 
    _opControl = de->_opControl;
    _memOp = de->_memOp;
@@ -66,6 +69,7 @@ ExecMem::ExecMem (void)
 
    _sreg2 = 0;
    _freg = 0;
+   _readFreg = FALSE;
 
    _num_jal = 0;
    _num_jr = 0;
@@ -105,6 +109,7 @@ ExecMem::copy (ExecMem *em)
 
    _sreg2 = em->_sreg2;
    _freg = em->_freg;
+   _readFreg = em->_readFreg;
 
    _hi = em->_hi;
    _lo = em->_lo;
@@ -113,6 +118,7 @@ ExecMem::copy (ExecMem *em)
 Exe::Exe (Mipc *mc)
 {
    _mc = mc;
+   _ins = 0;
 }
 
 Exe::~Exe (void) {}
@@ -120,83 +126,70 @@ Exe::~Exe (void) {}
 void
 Exe::MainLoop (void)
 {
-   unsigned int ins;
-   Bool isSyscall, isIllegalOp;
-
    while (1) {
       AWAIT_P_PHI0;	// @posedge
-      ExecMem *em = new ExecMem(_mc->_de);
-
-      if (_mc->_de->_sreg1 != 0)
-         em->_decodedSRC1 = _mc->_gprState[_mc->_de->_sreg1];
-      if (_mc->_de->_sreg2 != 0 && _mc->_de->_memControl == FALSE)
-         em->_decodedSRC2 = _mc->_gprState[_mc->_de->_sreg2];
-      em->_hi = _mc->_gprState[HI];
-      em->_lo = _mc->_gprState[LO];
-      if (_mc->_de->_freg != 0)
-         em->_decodedSRC1 = _mc->_fprState[(_mc->_de->_freg)>>1].l[FP_TWIDDLE^((_mc->_de->_freg)&1)];
-
-      if (!em->_isIllegalOp && !em->_isSyscall && em->_bd == 1)       // Instruction is a branch instruction
-      {
-         em->_opControl(em, ins);
-         if (em->_btaken) {
-            _mc->_pc = em->_btgt;
-         }
-      }
-
+      Posedge ();
       AWAIT_P_PHI1;	// @negedge
-      _mc->_em->copy(em);
-      // if(em->_pc == 0x40555C)
-        // _mc->dumpregs();
-
-      ins = _mc->_em->_ins;
-      if (!_mc->_em->_isSyscall && !_mc->_em->_isIllegalOp) {
-         _mc->_em->_opControl(_mc->_em,ins);
-
-         if (_mc->_em->_memControl == FALSE) 
-         {
-            unsigned decodedDST = _mc->_em->_decodedDST;
-            if (_mc->_em->_writeREG) { 
-               _mc->_gprState[decodedDST] = _mc->_em->_opResultLo;
-#ifdef MIPC_DEBUG
-               fprintf(_mc->_debugLog, "<%llu> Writing to state reg %u, value: %#x\n", SIM_TIME, decodedDST, _mc->_em->_opResultLo);
-#endif
-            }
-            else if (_mc->_em->_writeFREG) 
-               _mc->_fprState[(decodedDST)>>1].l[FP_TWIDDLE^((decodedDST)&1)] = _mc->_em->_opResultLo;
-            else if (_mc->_em->_loWPort || _mc->_em->_hiWPort) {
-               if (_mc->_em->_loWPort) { 
-                  _mc->_gprState[LO] = _mc->_em->_opResultLo;
-#ifdef MIPC_DEBUG
-               fprintf(_mc->_debugLog, "<%llu> Writing to state reg Lo, value: %#x\n", SIM_TIME, _mc->_em->_opResultLo);
-#endif
-               }
-               if (_mc->_em->_hiWPort) {
-                  _mc->_gprState[HI] = _mc->_em->_opResultHi;
-#ifdef MIPC_DEBUG
-               fprintf(_mc->_debugLog, "<%llu> Writing to state reg Hi, value: %#x\n", SIM_TIME, _mc->_em->_opResultHi);
-#endif
-               }
-            }
-            _mc->_gprState[0] = 0;
-         }
+      Negedge ();
+   }
+}
+
+void
+Exe::Posedge (void)
+{
+   ExecMem *em = _mc->_emNext;
+   em->Latch(_mc->_de);
+
+   // Operand selection: EX->EX from _em, MEM->EX from _mw, else the register file
+   if (_mc->_de->_sreg1 != 0 && _mc->_de->_sreg1 < 32)	// mfhi/mflo name HI/LO
+      em->_decodedSRC1 = _mc->BypassGpr(_mc->_de->_sreg1, _mc->_em, _mc->_mw);
+   if (_mc->_de->_sreg2 != 0 && _mc->_de->_memControl == FALSE)
+      em->_decodedSRC2 = _mc->BypassGpr(_mc->_de->_sreg2, _mc->_em, _mc->_mw);
+   em->_hi = _mc->BypassHi(_mc->_em, _mc->_mw);
+   em->_lo = _mc->BypassLo(_mc->_em, _mc->_mw);
+   if (_mc->_de->_readFreg && _mc->_de->_memControl == FALSE)
+      em->_decodedSRC1 = _mc->BypassFpr(_mc->_de->_freg, _mc->_em, _mc->_mw);
+
+   if (!em->_isIllegalOp && !em->_isSyscall && em->_bd == 1)       // Instruction is a branch instruction
+   {
+      em->_opControl(em, _ins);
+      // fetch checks its path against this at @negedge
+      _mc->_brPending = TRUE;
+      _mc->_brActual = em->_btaken ? em->_btgt : em->_pc + 8;
+      _mc->_brResolved++;
+      _mc->_bp->Update (em->_pc, em->_ins, em->_btaken, em->_btgt);
+   }
+}
+
+void
+Exe::Negedge (void)
+{
+   unsigned int ins;
+   Bool isSyscall;
+
+   _mc->_em->copy(_mc->_emNext);
+   // if(em->_pc == 0x40555C)
+     // _mc->dumpregs();
+
+   ins = _ins = _mc->_em->_ins;
+   if (!_mc->_em->_isSyscall && !_mc->_em->_isIllegalOp) {
+      _mc->_em->_opControl(_mc->_em,ins);
 #ifdef MIPC_DEBUG
-         fprintf(_mc->_debugLog, "<%llu> Executed ins %#x\n", SIM_TIME, ins);
+      fprintf(_mc->_debugLog, "<%llu> Executed ins %#x\n", SIM_TIME, ins);
 	      fflush(_mc->_debugLog);
 #endif
-      }
-      else if (isSyscall) {
-         //TODO: Zero out pipeline registers
+   }
+   else if (isSyscall) {
+      //TODO: Zero out pipeline registers
 #ifdef MIPC_DEBUG
-         fprintf(_mc->_debugLog, "<%llu> Deferring execution of syscall ins %#x\n", SIM_TIME, ins);
+      fprintf(_mc->_debugLog, "<%llu> Deferring execution of syscall ins %#x\n", SIM_TIME, ins);
 	      fflush(_mc->_debugLog);
 #endif
-      }
-      else {
+   }
+   else {
 #ifdef MIPC_DEBUG
-         fprintf(_mc->_debugLog, "<%llu> Illegal ins %#x in execution stage at PC %#x\n", SIM_TIME, ins, _mc->_pc);
+      fprintf(_mc->_debugLog, "<%llu> Illegal ins %#x in execution stage at PC %#x\n", SIM_TIME, ins, _mc->_pc);
 	      fflush(_mc->_debugLog);
 #endif
-      }
    }
 }
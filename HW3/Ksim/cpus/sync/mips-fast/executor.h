@@ -12,6 +12,10 @@ public:
   
    FAKE_SIM_TEMPLATE;
 
+   void Posedge (void);		// Work done @posedge
+   void Negedge (void);		// Work done @negedge
+
    Mipc *_mc;
+   unsigned int _ins;		// instruction executed on the last @negedge
 };
 #endif
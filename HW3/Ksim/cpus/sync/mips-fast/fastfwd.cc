@@ -0,0 +1,397 @@
+#include "pipeline.h"
+#include "mips.h"
+#include "bpred.h"
+#include "timing.h"
+
+/*------------------------------------------------------------------------
+ *
+ *  Functional fast-forward
+ *
+ *   Straight-line runs of code are translated once into TransBlocks:
+ *   the DecodeExec that Dec() produced for each instruction plus the
+ *   kind of work it needs, ending after a branch and its delay slot or
+ *   at a syscall. Running a block only re-reads the source registers
+ *   (ReadOperands) and calls the pre-bound _opControl/_memOp. Blocks
+ *   are linked to the block at each exit, so most block transitions
+ *   skip the lookup. Blocks are tagged by PC only: a program that
+ *   writes its own code must run with Mipc.FastForwardBlocks = 0.
+ *
+ *------------------------------------------------------------------------
+ */
+
+/*
+ * Result write of a functionally executed instruction
+ */
+static inline void
+Retire (Mipc *mc, ExecMem *em)
+{
+   unsigned decodedDST = em->_decodedDST;
+
+   if (em->_writeREG)
+      mc->_gpr[decodedDST] = em->_opResultLo;
+   else if (em->_writeFREG)
+      mc->_fpr[(decodedDST)>>1].l[FP_TWIDDLE^((decodedDST)&1)] = em->_opResultLo;
+   else {
+      if (em->_loWPort)
+         mc->_lo = em->_opResultLo;
+      if (em->_hiWPort)
+         mc->_hi = em->_opResultHi;
+   }
+   mc->_gpr[0] = 0;
+}
+
+/*------------------------------------------------------------------------
+ *
+ *  Mipc::Translate --
+ *
+ *   Return the block starting at "pc", translating it into its cache
+ *   slot if it is not there. A block of length 0 starts with an
+ *   instruction only the single-step path handles.
+ *
+ *------------------------------------------------------------------------
+ */
+TransBlock *
+Mipc::Translate (unsigned int pc)
+{
+   TransBlock *b = &_transCache[(pc >> 2) & _transCacheMask];
+   TransIns *t;
+   unsigned int ins;
+
+   if (b->_valid && b->_pc == pc)
+      return b;
+
+   b->_valid = TRUE;
+   b->_pc = pc;
+   b->_n = 0;
+   b->_next[0] = b->_next[1] = NULL;
+   _ffBlocks++;
+
+   while (b->_n < FF_BLOCK_MAX) {
+      t = &b->_ins[b->_n];
+      ins = _mem->BEGetWord (pc, _mem->Read(pc & ~(LL)0x7));
+      t->_de._ins = ins;
+      t->_de._pc = pc;
+      t->_de._bd = 0;
+      t->_de._sreg1 = t->_de._sreg2 = t->_de._freg = 0;
+      t->_de.Dec (this, _em, _mw, ins);
+
+      if (t->_de._isIllegalOp)
+         break;
+      if (b->_n > 0 && b->_ins[b->_n-1]._kind == FF_BRANCH) {
+         // delay slot: must be plain, or the branch goes back out too
+         if (t->_de._bd || t->_de._isSyscall)
+            b->_n--;
+         else {
+            t->_kind = t->_de._memControl ? FF_MEM : FF_ALU;
+            b->_n++;
+         }
+         break;
+      }
+
+      b->_n++;
+      pc += 4;
+      if (t->_de._isSyscall) {
+         t->_kind = FF_SYSCALL;
+         break;
+      }
+      t->_kind = t->_de._bd ? FF_BRANCH : (t->_de._memControl ? FF_MEM : FF_ALU);
+   }
+   // a branch with its delay slot cut off by FF_BLOCK_MAX
+   if (b->_n > 0 && b->_ins[b->_n-1]._kind == FF_BRANCH)
+      b->_n--;
+
+   return b;
+}
+
+/*------------------------------------------------------------------------
+ *
+ *  Mipc::RunBlock --
+ *
+ *   Execute a translated block, dispatching on each instruction's kind
+ *   with computed goto where the compiler has it. Returns the PC the
+ *   block exits to.
+ *
+ *------------------------------------------------------------------------
+ */
+unsigned int
+Mipc::RunBlock (TransBlock *b, ExecMem *em, MemWb *mw)
+{
+   TransIns *t = b->_ins;
+   TransIns *end = b->_ins + b->_n;
+   unsigned int npc = b->_pc + 4*b->_n;
+
+#ifdef __GNUC__
+   static void *dispatch[] = { &&do_alu, &&do_mem, &&do_branch, &&do_syscall };
+#define FF_DISPATCH	goto *dispatch[t->_kind]
+#else
+#define FF_DISPATCH						\
+   switch (t->_kind) {						\
+   case FF_ALU: goto do_alu;					\
+   case FF_MEM: goto do_mem;					\
+   case FF_BRANCH: goto do_branch;				\
+   default: goto do_syscall;					\
+   }
+#endif
+#define FF_NEXT		do { if (++t == end) return npc; FF_DISPATCH; } while (0)
+
+   FF_DISPATCH;
+
+do_alu:
+   t->_de.ReadOperands (this);
+   em->Latch (&t->_de);
+   em->_hi = _hi;
+   em->_lo = _lo;
+   em->_opControl (em, t->_de._ins);
+   Retire (this, em);
+   FF_NEXT;
+
+do_mem:
+   t->_de.ReadOperands (this);
+   em->Latch (&t->_de);
+   em->_opControl (em, t->_de._ins);
+   mw->Latch (em);
+   mw->_memOp (this, mw);
+   em->_opResultLo = mw->_opResultLo;
+   Retire (this, em);
+   FF_NEXT;
+
+do_branch:
+   t->_de.ReadOperands (this);
+   em->Latch (&t->_de);
+   em->_opControl (em, t->_de._ins);
+   if (em->_btaken)
+      npc = em->_btgt;
+   _bp->Update (t->_de._pc, t->_de._ins, em->_btaken, em->_btgt);
+   Retire (this, em);
+   FF_NEXT;
+
+do_syscall:
+   fake_syscall (t->_de._pc);
+   FF_NEXT;
+
+#undef FF_NEXT
+#undef FF_DISPATCH
+}
+
+/*------------------------------------------------------------------------
+ *
+ *  Mipc::Step --
+ *
+ *   Execute the instruction at _pc, whose successor is *npc, and
+ *   advance both. "de" and "em" are left as the instruction saw them.
+ *   Branches train the predictor and BTB as they resolve.
+ *
+ *------------------------------------------------------------------------
+ */
+void
+Mipc::Step (DecodeExec *de, ExecMem *em, MemWb *mw, unsigned int *npc)
+{
+   unsigned int pc = _pc;
+   unsigned int ins = _mem->BEGetWord (pc, _mem->Read(pc & ~(LL)0x7));
+
+   _pc = *npc;
+   *npc = *npc + 4;
+
+   de->_ins = ins;
+   de->_pc = pc;
+   de->_bd = 0;
+   de->_sreg1 = de->_sreg2 = de->_freg = 0;
+   de->CachedDec (this, em, mw, ins);
+
+   if (de->_isSyscall) {
+      fake_syscall (pc);
+      return;
+   }
+   if (de->_isIllegalOp) {
+      printf("Illegal ins %#x at PC %#x. Terminating simulation!\n", ins, pc);
+      printf("Register state on termination:\n\n");
+      dumpregs();
+      exit(0);
+   }
+
+   em->Latch (de);
+   em->_hi = _hi;
+   em->_lo = _lo;
+   em->_btaken = 0;
+   em->_opControl (em, ins);
+   if (em->_bd && em->_btaken)
+      *npc = em->_btgt;
+   if (em->_bd)
+      _bp->Update (pc, ins, em->_btaken, em->_btgt);
+
+   if (em->_memControl) {
+      mw->Latch (em);
+      mw->_memOp (this, mw);
+      em->_opResultLo = mw->_opResultLo;
+   }
+
+   Retire (this, em);
+}
+
+/*------------------------------------------------------------------------
+ *
+ *  Mipc::FastForward --
+ *
+ *   Run the program from _pc through the stage functions (Dec,
+ *   _opControl, _memOp) with no pipeline and no simulated time, a
+ *   translated block at a time when one fits, else one instruction at
+ *   a time. Stops after "count" instructions (0 = no limit) or
+ *   at PC "stopPc" (0 = none), but never inside a branch delay slot,
+ *   which the pipeline has no way to resume. Registers and memory are
+ *   the ones the pipeline uses, so nothing is transferred, and every
+ *   branch trains the predictor and BTB so they are warm for the
+ *   detailed part that follows. It must be called with the pipeline
+ *   empty, at the start or between sampled windows.
+ *
+ *------------------------------------------------------------------------
+ */
+void
+Mipc::FastForward (LL count, unsigned int stopPc)
+{
+   DecodeExec de;
+   ExecMem em;
+   MemWb mw;
+   unsigned int npc;	// next PC, the branch target after a delay slot
+   TransBlock *b;
+   TransBlock **link;	// exit of the last block run, NULL after a single step
+   LL limit;		// _ffInsts to stop at, 0 for none
+   LL fpinst, num_sys, sys_load, sys_store, hits, misses;
+
+   Assert (_boot, "Mipc::FastForward() called without boot?");
+
+   if (!_transCache && ParamGetInt ("Mipc.FastForwardBlocks")) {
+      unsigned int entries = ParamGetInt ("Mipc.FastForwardBlocks");
+      if (entries & (entries - 1))
+         fatal_error ("Mipc.FastForwardBlocks must be a power of two, got %u", entries);
+      _transCache = new TransBlock[entries];
+      _transCacheMask = entries - 1;
+   }
+
+   // Statistics count detailed execution only; the decode cache stays warm
+   fpinst = _fpinst;
+   num_sys = _num_sys;
+   sys_load = _sys->_num_load;
+   sys_store = _sys->_num_store;
+   hits = _decodeHits;
+   misses = _decodeMisses;
+
+   limit = count ? _ffInsts + count : 0;
+   link = NULL;
+   npc = _pc + 4;
+   while (!_sim_exit) {
+      if (npc == _pc + 4 && ((limit && _ffInsts >= limit) || _pc == stopPc))
+         break;
+
+      if (_transCache && npc == _pc + 4) {
+         if (link && *link && (*link)->_pc == _pc)
+            b = *link;
+         else {
+            b = Translate (_pc);
+            if (link)
+               *link = b;
+         }
+         // the whole block must run before the next stop check
+         if (b->_n > 0 && (!limit || _ffInsts + b->_n <= limit)
+             && !(stopPc > b->_pc && stopPc < b->_pc + 4*b->_n)) {
+            _pc = RunBlock (b, &em, &mw);
+            npc = _pc + 4;
+            _ffInsts += b->_n;
+            link = &b->_next[_pc != b->_pc + 4*b->_n];
+            continue;
+         }
+      }
+      link = NULL;
+
+      Step (&de, &em, &mw, &npc);
+      _ffInsts++;
+   }
+
+   _fpinst = fpinst;
+   _num_sys = num_sys;
+   _sys->_num_load = sys_load;
+   _sys->_num_store = sys_store;
+   _decodeHits = hits;
+   _decodeMisses = misses;
+}
+
+
+/*------------------------------------------------------------------------
+ *
+ *  Mipc::TimingLoop --
+ *
+ *   Execute the program functionally and pass every instruction, in
+ *   program order, to the timing model in _timing. Branch prediction is
+ *   looked up here and trained in Step so the model only sees its
+ *   outcome. Replaces the pipeline tasks; never returns.
+ *
+ *------------------------------------------------------------------------
+ */
+void
+Mipc::TimingLoop (void)
+{
+   DecodeExec *de = _de;	// the pipeline's latches are idle; their
+   ExecMem *em = _em;		// counters feed MipcDumpstats as usual
+   MemWb *mw = _mw;
+   TimedIns t;
+   unsigned int npc;
+   unsigned int target;
+   Bool predicted;
+
+   Assert (_boot && _timing, "Mipc::TimingLoop() called without boot?");
+
+   _nfetched = 0;
+   npc = _pc + 4;
+   while (!_sim_exit) {
+      t._pc = _pc;
+      predicted = _bp->Predict (_pc, &target);
+      Step (de, em, mw, &npc);
+      _nfetched++;
+
+      t._src[0] = t._src[1] = t._data = 0;
+      t._dst[0] = t._dst[1] = 0;
+      t._load = t._store = FALSE;
+      t._branch = t._taken = t._mispredict = FALSE;
+      t._syscall = de->_isSyscall;
+      if (!t._syscall) {
+         if (de->_sreg1 < 32)		// mfhi/mflo name HI/LO here
+            t._src[0] = de->_sreg1;
+         if (de->_memControl) {
+            t._data = de->_readFreg ? TIMING_FPR + de->_freg : de->_sreg2;
+            t._load = de->_writeREG || de->_writeFREG;
+            t._store = !t._load;
+            t._addr = em->_MAR;
+         }
+         else if (de->_readFreg)
+            t._src[1] = TIMING_FPR + de->_freg;
+         else
+            t._src[1] = de->_sreg2;
+         if (de->_opControl == ExecMem::func_mfhi)
+            t._src[1] = TIMING_HI;
+         else if (de->_opControl == ExecMem::func_mflo)
+            t._src[1] = TIMING_LO;
+
+         if (de->_writeREG)
+            t._dst[0] = de->_decodedDST;
+         else if (de->_writeFREG)
+            t._dst[0] = TIMING_FPR + de->_decodedDST;
+         if (de->_hiWPort)
+            t._dst[0] = TIMING_HI;
+         if (de->_loWPort)
+            t._dst[1] = TIMING_LO;
+      }
+
+      if (de->_bd && !t._syscall) {
+         t._branch = TRUE;
+         t._taken = em->_btaken;
+         if (_bp->_kind != BP_PERFECT)
+            t._mispredict = predicted != t._taken || (predicted && target != em->_btgt);
+         _brResolved++;
+         if (t._mispredict)
+            _brMispredicts++;
+      }
+
+      _timing->Add (&t);
+   }
+
+   EndSimulation ();
+}
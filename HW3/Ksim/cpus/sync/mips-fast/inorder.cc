@@ -0,0 +1,154 @@
+#include "inorder.h"
+
+InOrderTiming::InOrderTiming (int width)
+{
+   int i;
+
+   _width = width;
+   _memPorts = width > 1 ? width/2 : 1;
+
+   for (i = 0; i < TIMING_REGS; i++)
+      _ready[i] = 0;
+
+   _fetchCycle = 0;
+   _fetchSlots = 0;
+   _groupEnd = FALSE;
+   _redirect = 0;
+   _slot = 0;
+
+   _issueCycle = 0;
+   _issueSlots = 0;
+   _memSlots = 0;
+   _lastDone = 0;
+
+   _issueHist = new LL[width + 1];
+   for (i = 0; i <= width; i++)
+      _issueHist[i] = 0;
+   _delayFetch = 0;
+   _delayData = 0;
+   _delayWidth = 0;
+   _delayMem = 0;
+   _delaySerial = 0;
+}
+
+InOrderTiming::~InOrderTiming (void)
+{
+   delete [] _issueHist;
+}
+
+/*
+ * Same latencies as the scalar pipeline: EX two cycles after fetch, ALU
+ * results bypassed to the next EX, loads a cycle later, store data
+ * needed in MEM. A branch resolves in EX: the group ends after its delay
+ * slot if it is taken, and on a misprediction fetch restarts the cycle
+ * after. A syscall issues alone once everything before it is done, and
+ * fetch resumes after its WB.
+ */
+void
+InOrderTiming::Add (TimedIns *t)
+{
+   LL fetch, issue, earliest, ready;
+   LL *why;
+   Bool mem = t->_load || t->_store;
+   int i;
+
+   // fetch
+   if (_fetchSlots == _width || _groupEnd) {
+      _fetchCycle++;
+      _fetchSlots = 0;
+      _groupEnd = FALSE;
+   }
+   if (_fetchCycle < _redirect) {
+      _fetchCycle = _redirect;
+      _fetchSlots = 0;
+   }
+   fetch = _fetchCycle;
+   _fetchSlots++;
+
+   if (_slot) {			// this is the delay slot
+      _slot = 0;
+      if (_slotMispredict)
+         _redirect = _slotResolve + 1;
+      if (_slotTaken || _slotMispredict)
+         _groupEnd = TRUE;
+   }
+
+   // issue: in order, after decode, operands bypassable, slots free
+   earliest = _issueCycle;
+   issue = earliest;
+   why = NULL;
+   if (fetch + 2 > issue) {
+      issue = fetch + 2;
+      why = &_delayFetch;
+   }
+   for (i = 0; i < 2; i++)
+      if (_ready[t->_src[i]] > issue) {
+         issue = _ready[t->_src[i]];
+         why = &_delayData;
+      }
+   if (_ready[t->_data] > issue + 1) {
+      issue = _ready[t->_data] - 1;
+      why = &_delayData;
+   }
+   if (t->_syscall && _lastDone + 1 > issue) {
+      issue = _lastDone + 1;
+      why = &_delaySerial;
+   }
+   if (issue == _issueCycle && (_issueSlots == _width || (mem && _memSlots == _memPorts))) {
+      why = _issueSlots == _width ? &_delayWidth : &_delayMem;
+      issue++;
+   }
+   if (why)
+      *why += issue - earliest;
+
+   if (issue > _issueCycle) {
+      _issueHist[_issueSlots]++;
+      _issueHist[0] += issue - _issueCycle - 1;
+      _issueCycle = issue;
+      _issueSlots = 0;
+      _memSlots = 0;
+   }
+   _issueSlots++;
+   if (mem)
+      _memSlots++;
+
+   // results
+   ready = issue + (t->_load ? 2 : 1);
+   for (i = 0; i < 2; i++)
+      if (t->_dst[i])
+         _ready[t->_dst[i]] = ready;
+   if (issue + 2 > _lastDone)
+      _lastDone = issue + 2;
+
+   if (t->_branch) {
+      _slot = 1;
+      _slotTaken = t->_taken;
+      _slotMispredict = t->_mispredict;
+      _slotResolve = issue;
+   }
+   if (t->_syscall) {
+      _redirect = issue + 3;
+      _groupEnd = TRUE;
+   }
+}
+
+LL
+InOrderTiming::Cycles (void)
+{
+   return _lastDone + 1;
+}
+
+void
+InOrderTiming::Dumpstats (Log &l)
+{
+   char buf[256];
+   int i, n;
+
+   l.print ("In-order superscalar: width %d, %d memory port(s)", _width, _memPorts);
+   n = 0;
+   for (i = 0; i <= _width && n < (int)sizeof(buf) - 32; i++)
+      n += sprintf (buf + n, "%s%d: %llu", i ? ", " : "", i, _issueHist[i] + (i == _issueSlots ? 1 : 0));
+   l.print ("Cycles issuing 0..%d instructions: %s", _width, buf);
+   l.print ("Issue cycles lost: fetch %llu, data %llu, width %llu, memory port %llu, syscall %llu",
+            _delayFetch, _delayData, _delayWidth, _delayMem, _delaySerial);
+}
@@ -0,0 +1,47 @@
+#ifndef __INORDER_H__
+#define __INORDER_H__
+
+#include "timing.h"
+
+/*
+ * In-order superscalar: the scalar pipeline's stages (IF, ID, EX, MEM,
+ * WB) with "width" instructions fetched and issued per cycle.
+ */
+class InOrderTiming : public TimingModel {
+public:
+   InOrderTiming (int width);
+   ~InOrderTiming ();
+
+   void Add (TimedIns *t);
+   LL Cycles (void);
+   void Dumpstats (Log &l);
+
+   int _width;
+   int _memPorts;		// loads and stores issued per cycle
+
+   LL _ready[TIMING_REGS];	// first EX cycle that can bypass the value
+
+   /* fetch groups */
+   LL _fetchCycle;
+   int _fetchSlots;		// instructions fetched in _fetchCycle
+   Bool _groupEnd;		// next fetch starts a new group
+   LL _redirect;		// no fetch before this cycle
+   int _slot;			// 1 while fetching a branch's delay slot
+   Bool _slotTaken, _slotMispredict;
+   LL _slotResolve;		// EX cycle of that branch
+
+   /* issue */
+   LL _issueCycle;
+   int _issueSlots;		// instructions issued in _issueCycle
+   int _memSlots;
+   LL _lastDone;		// last WB cycle
+
+   /* statistics */
+   LL *_issueHist;		// cycles that issued 0..width instructions
+   LL _delayFetch;		// issue cycles lost waiting on fetch
+   LL _delayData;		// ... on operands
+   LL _delayWidth;		// ... on a full issue group
+   LL _delayMem;		// ... on the memory ports
+   LL _delaySerial;		// ... draining for a syscall
+};
+#endif
@@ -3,6 +3,8 @@
 #include "executor.h"
 #include "memory.h"
 #include "wb.h"
+#include "inorder.h"
+#include "ooo.h"
 #include "tasking.h"
 #include <stdlib.h>
 #include <string.h>
@@ -14,6 +16,37 @@ void cleanup (void)
 
 #define SIZE 256
 
+/*
+ * Runs the stages' @posedge and @negedge halves as plain calls instead of
+ * tasks. The order is the one the tasking library gives the tasks created
+ * below (last created runs first), so results are identical, but a cycle
+ * costs no context switches. With no tasks, AWAIT_P_PHI* just advance time.
+ */
+static void CycleLoop (Mipc *mh, Decode *dec, Exe *exec, Memory *mem, Writeback *wb)
+{
+  Assert (mh->_boot, "CycleLoop() called without boot?");
+
+  mh->_nfetched = 0;
+
+  while (!mh->_sim_exit) {
+     AWAIT_P_PHI0;	// @posedge
+     wb->Posedge ();
+     mem->Posedge ();
+     exec->Posedge ();
+     dec->Posedge ();
+     mh->Posedge ();
+
+     AWAIT_P_PHI1;	// @negedge
+     wb->Negedge ();
+     mem->Negedge ();
+     exec->Negedge ();
+     dec->Negedge ();
+     mh->Negedge ();
+  }
+
+  mh->EndSimulation ();
+}
+
 int main (int argc, char **argv)
 {
   Mipc *mh;
@@ -38,6 +71,24 @@ int main (int argc, char **argv)
   RegisterDefault ("MemSystem.Type", "None");
   RegisterDefault ("Log.StartDumpTime", 0);
   RegisterDefault ("Mipc.PeriodicTimer", 100000);
+  RegisterDefault ("Mipc.CycleLoop", 0);
+  RegisterDefault ("Mipc.DecodeCache", 4096);
+  RegisterDefault ("Mipc.FastForward", (LL)0);
+  RegisterDefault ("Mipc.FastForwardPC", 0);
+  RegisterDefault ("Mipc.FastForwardBlocks", 1024);
+  RegisterDefault ("Mipc.SampleInterval", (LL)0);
+  RegisterDefault ("Mipc.SampleWarmup", (LL)2000);
+  RegisterDefault ("Mipc.SampleWindow", (LL)1000);
+  RegisterDefault ("Mipc.BranchPredictor", "bimodal");
+  RegisterDefault ("Mipc.BPredEntries", 4096);
+  RegisterDefault ("Mipc.BTBEntries", 512);
+  RegisterDefault ("Mipc.BPredHistory", 12);
+  RegisterDefault ("Mipc.IssueWidth", 1);
+  RegisterDefault ("Mipc.OutOfOrder", 0);
+  RegisterDefault ("Mipc.ROBSize", 64);
+  RegisterDefault ("Mipc.IQSize", 32);
+  RegisterDefault ("Mipc.LSQSize", 16);
+  RegisterDefault ("Mipc.RenameRegs", 32);
 
   /* fixup arguments */
   if (argc > 1) {
@@ -98,15 +149,37 @@ int main (int argc, char **argv)
   exec = new Exe(mh);
   mem = new Memory(mh);
   wb = new Writeback(mh);
-  SimCreateTask (mh, "FETCH");
-  SimCreateTask (dec, "DECODE");
-  SimCreateTask (exec, "EXE");
-  SimCreateTask (mem, "MEM");
-  SimCreateTask (wb, "WB");
+  if (ParamGetInt ("Mipc.OutOfOrder"))
+     mh->_timing = new OutOfOrderTiming (ParamGetInt ("Mipc.IssueWidth"),
+                                         ParamGetInt ("Mipc.ROBSize"),
+                                         ParamGetInt ("Mipc.IQSize"),
+                                         ParamGetInt ("Mipc.LSQSize"),
+                                         ParamGetInt ("Mipc.RenameRegs"));
+  else if (ParamGetInt ("Mipc.IssueWidth") > 1)
+     mh->_timing = new InOrderTiming (ParamGetInt ("Mipc.IssueWidth"));
+  if (mh->_timing && ParamGetLL ("Mipc.SampleInterval"))
+     fatal_error ("Mipc.SampleInterval needs the pipeline; unset Mipc.IssueWidth > 1 and Mipc.OutOfOrder");
+  if (!ParamGetInt ("Mipc.CycleLoop") && !mh->_timing) {
+     SimCreateTask (mh, "FETCH");
+     SimCreateTask (dec, "DECODE");
+     SimCreateTask (exec, "EXE");
+     SimCreateTask (mem, "MEM");
+     SimCreateTask (wb, "WB");
+  }
 
   /* there are arguments! */
   if (argc > 0) 
 	mh->_sys->ArgumentSetup (argc, argv, ParamGetInt ("Mipc.ArgvAddr"));
 
+  /* functional fast-forward, then detailed timing from where it stopped */
+  if (ParamGetLL ("Mipc.FastForward") || ParamGetInt ("Mipc.FastForwardPC"))
+     mh->FastForward (ParamGetLL ("Mipc.FastForward"), ParamGetInt ("Mipc.FastForwardPC"));
+
+  if (mh->_timing)
+     mh->TimingLoop ();	// never returns
+
+  if (ParamGetInt ("Mipc.CycleLoop"))
+     CycleLoop (mh, dec, exec, mem, wb);	// never returns
+
   simulate (cleanup);
 }
@@ -1,7 +1,9 @@
 #include "pipeline.h"
 #include "memory.h"
 
-MemWb::MemWb (ExecMem *em) {
+void
+MemWb::Latch (ExecMem *em) 
+{
    _pc = em->_pc;
    _ins = em->_ins;
 
@@ -80,50 +82,43 @@ Memory::~Memory (void) {}
 void
 Memory::MainLoop (void)
 {
-   Bool memControl;
-
    while (1) {
       AWAIT_P_PHI0;	// @posedge
-      MemWb *mw = new MemWb(_mc->_em);
-      if (_mc->_em->_sreg2 != 0 && _mc->_em->_memControl == TRUE) {
-         mw->_subregOperand = _mc->_gprState[_mc->_em->_sreg2];
-         if (_mc->_em->_freg != 0)
-            mw->_decodedSRC3 = _mc->_fprState[(_mc->_em->_freg)>>1].l[FP_TWIDDLE^((_mc->_em->_freg)&1)];
-         else
-            mw->_decodedSRC3 = _mc->_gprState[_mc->_em->_sreg2];
-     }
-
-      AWAIT_P_PHI1;       // @negedge
-      _mc->_mw->copy(mw);
-      if (_mc->_mw->_memControl) {
-         _mc->_mw->_memOp (_mc, _mc->_mw);
-
-         unsigned decodedDST = _mc->_mw->_decodedDST;
-         if (_mc->_mw->_writeREG) { 
-            _mc->_gprState[decodedDST] = _mc->_mw->_opResultLo;
-#ifdef MIPC_DEBUG
-            fprintf(_mc->_debugLog, "<%llu> Memop: Writing to reg %u, value: %#x\n", SIM_TIME, decodedDST, _mc->_mw->_opResultLo);
-#endif
-         }
-         else if (_mc->_mw->_writeFREG) 
-            _mc->_fprState[(decodedDST)>>1].l[FP_TWIDDLE^((decodedDST)&1)] = _mc->_mw->_opResultLo;
-         else if (_mc->_mw->_loWPort || _mc->_mw->_hiWPort) {
-            if (_mc->_mw->_loWPort) 
-               _mc->_gprState[LO] = _mc->_mw->_opResultLo;
-            if (_mc->_mw->_hiWPort) 
-               _mc->_gprState[HI] = _mc->_mw->_opResultHi;
-         }
-         _mc->_gprState[0] = 0;
+      Posedge ();
+      AWAIT_P_PHI1;	// @negedge
+      Negedge ();
+   }
+}
+
+void
+Memory::Posedge (void)
+{
+   MemWb *mw = _mc->_mwNext;
+   mw->Latch(_mc->_em);
+   // Store data and lwl/lwr merge operand: MEM->MEM from _mw, else the register file
+   if (_mc->_em->_sreg2 != 0 && _mc->_em->_memControl == TRUE) {
+      mw->_subregOperand = _mc->BypassGpr(_mc->_em->_sreg2, NULL, _mc->_mw);
+      mw->_decodedSRC3 = mw->_subregOperand;
+   }
+   if (_mc->_em->_readFreg && _mc->_em->_memControl == TRUE)
+      mw->_decodedSRC3 = _mc->BypassFpr(_mc->_em->_freg, NULL, _mc->_mw);
+}
+
+void
+Memory::Negedge (void)
+{
+   _mc->_mw->copy(_mc->_mwNext);
+   if (_mc->_mw->_memControl) {
+      _mc->_mw->_memOp (_mc, _mc->_mw);
 #ifdef MIPC_DEBUG
-         fprintf(_mc->_debugLog, "<%llu> Accessing memory at address %#x for ins %#x\n", SIM_TIME, _mc->_mw->_MAR, _mc->_mw->_ins);
+      fprintf(_mc->_debugLog, "<%llu> Accessing memory at address %#x for ins %#x\n", SIM_TIME, _mc->_mw->_MAR, _mc->_mw->_ins);
 	      fflush(_mc->_debugLog);
 #endif
-      }
-      else {
+   }
+   else {
 #ifdef MIPC_DEBUG
-         fprintf(_mc->_debugLog, "<%llu> Memory has nothing to do for ins %#x\n", SIM_TIME, _mc->_mw->_ins);
+      fprintf(_mc->_debugLog, "<%llu> Memory has nothing to do for ins %#x\n", SIM_TIME, _mc->_mw->_ins);
 	      fflush(_mc->_debugLog);
 #endif
-      }
    }
 }
@@ -12,6 +12,9 @@ public:
   
    FAKE_SIM_TEMPLATE;
 
+   void Posedge (void);		// Work done @posedge
+   void Negedge (void);		// Work done @negedge
+
    Mipc *_mc;
 };
 #endif
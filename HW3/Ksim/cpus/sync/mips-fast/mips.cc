@@ -1,12 +1,16 @@
 #include "pipeline.h"
 #include "mips.h"
 #include <assert.h>
+#include <math.h>
 #include "mips-irix5.h"
+#include "bpred.h"
+#include "timing.h"
 
 FetchDecode::FetchDecode (void) 
 {
    _ins = 0;
    _pc = 0;
+   _bubble = TRUE;
 }
 FetchDecode::~FetchDecode (void) {}
 
@@ -31,33 +35,211 @@ Mipc::~Mipc (void)
 void 
 Mipc::MainLoop (void)
 {
-   LL addr;
-   unsigned int ins;	// Local instruction register
-
    Assert (_boot, "Mipc::MainLoop() called without boot?");
 
    _nfetched = 0;
 
    while (!_sim_exit) {
       AWAIT_P_PHI0;	// @posedge
-      Bool stall = _stallFetch;
+      Posedge ();
 
       AWAIT_P_PHI1;	// @negedge
-      if (!stall) {
-         addr = _pc;
-         ins = _mem->BEGetWord (addr, _mem->Read(addr & ~(LL)0x7));
+      Negedge ();
+   }
+
+   EndSimulation ();
+}
+
+void
+Mipc::Posedge (void)
+{
+   _fetchStall = _stallFetch;
+}
+
+void
+Mipc::Negedge (void)
+{
+   LL addr;
+   unsigned int ins;	// Local instruction register
+   unsigned int target;
+   Bool squash = FALSE;
+
+   // A branch resolved in EX this cycle and this fetch follows its delay
+   // slot: off the actual path, the cycle is lost to the redirect
+   if (_brPending && !_fetchStall) {
+      _brPending = FALSE;
+      if (_pc != _brActual) {
+         _pc = _brActual;
+         _predArmed = FALSE;
+         if (_bp->_kind != BP_PERFECT) {
+            _brMispredicts++;
+            squash = TRUE;
+         }
+      }
+   }
+
+   if (_sampleDrain || squash) {
+      _fd->_ins = 0;		// bubble; a syscall or interlock restarts from its PC
+      _fd->_pc = _pc;
+      _fd->_bubble = TRUE;
+   }
+   else if (!_fetchStall) {
+      addr = _pc;
+      ins = _mem->BEGetWord (addr, _mem->Read(addr & ~(LL)0x7));
 #ifdef MIPC_DEBUG
-         fprintf(_debugLog, "<%llu> Fetched ins %#x from PC %#x\n", SIM_TIME, ins, _pc);
-         fflush(_debugLog);
+      fprintf(_debugLog, "<%llu> Fetched ins %#x from PC %#x\n", SIM_TIME, ins, _pc);
+      fflush(_debugLog);
 #endif
-         _fd->_ins = ins;
-         _fd->_pc = addr;
-         _pc = _pc + 4;
-         _nfetched++;
+      _fd->_ins = ins;
+      _fd->_pc = addr;
+      _fd->_bubble = FALSE;
+      _pc = _pc + 4;
+      _nfetched++;
+
+      if (_predArmed && addr == _predSlot)
+         _pc = _predTarget;	// delay slot, or its refetch after an interlock
+      else if (_bp->Predict (addr, &target)) {
+         _predArmed = TRUE;
+         _predSlot = addr + 4;
+         _predTarget = target;
       }
-      // _bd = 0;
+      else
+         _predArmed = FALSE;
+   }
+   // _bd = 0;
+
+   if (_sampleInterval)
+      Sample ();
+}
+
+/*------------------------------------------------------------------------
+ *
+ *  Bypass network
+ *
+ *   Results are taken from the youngest older instruction that writes
+ *   the register: EX/MEM first, then MEM/WB, then the register file.
+ *   A load in EX/MEM has no value yet; Decode::LoadUse keeps its
+ *   consumers a cycle behind so they find it in MEM/WB. Register 0 and
+ *   syscall/illegal latches never forward.
+ *
+ *------------------------------------------------------------------------
+ */
+unsigned int
+Mipc::BypassGpr (unsigned int reg, ExecMem *em, MemWb *mw)
+{
+   if (reg == 0)
+      return 0;
+   if (em && em->_writeREG && em->_decodedDST == reg && !em->_isSyscall && !em->_isIllegalOp) {
+      _bypassEx++;
+      return em->_opResultLo;
+   }
+   if (mw->_writeREG && mw->_decodedDST == reg && !mw->_isSyscall && !mw->_isIllegalOp) {
+      _bypassMem++;
+      return mw->_opResultLo;
    }
+   return _gpr[reg];
+}
 
+unsigned int
+Mipc::BypassFpr (unsigned int reg, ExecMem *em, MemWb *mw)
+{
+   if (em && em->_writeFREG && em->_decodedDST == reg && !em->_isSyscall && !em->_isIllegalOp) {
+      _bypassEx++;
+      return em->_opResultLo;
+   }
+   if (mw->_writeFREG && mw->_decodedDST == reg && !mw->_isSyscall && !mw->_isIllegalOp) {
+      _bypassMem++;
+      return mw->_opResultLo;
+   }
+   return _fpr[(reg)>>1].l[FP_TWIDDLE^((reg)&1)];
+}
+
+unsigned int
+Mipc::BypassHi (ExecMem *em, MemWb *mw)
+{
+   if (em->_hiWPort && !em->_isSyscall && !em->_isIllegalOp)
+      return em->_opResultHi;
+   if (mw->_hiWPort && !mw->_isSyscall && !mw->_isIllegalOp)
+      return mw->_opResultHi;
+   return _hi;
+}
+
+unsigned int
+Mipc::BypassLo (ExecMem *em, MemWb *mw)
+{
+   if (em->_loWPort && !em->_isSyscall && !em->_isIllegalOp)
+      return em->_opResultLo;
+   if (mw->_loWPort && !mw->_isSyscall && !mw->_isIllegalOp)
+      return mw->_opResultLo;
+   return _lo;
+}
+
+/*
+ * True for the instructions with a delay slot
+ */
+static inline Bool
+IsControl (unsigned int ins)
+{
+   unsigned int op = ins >> 26;
+
+   if (op == 0)
+      return (ins & 0x3f) == 8 || (ins & 0x3f) == 9;	// jr, jalr
+   return op >= 1 && op <= 7;		// regimm, j, jal, beq, bne, blez, bgtz
+}
+
+/*------------------------------------------------------------------------
+ *
+ *  Mipc::Sample --
+ *
+ *   Systematic sampling, run at the end of each fetch @negedge. Every
+ *   _sampleInterval instructions, a unit runs functionally (FastForward)
+ *   up to a detailed part: _sampleWarmup instructions to fill the
+ *   pipeline, then _sampleWindow measured ones whose CPI is one sample.
+ *   The functional part trains the branch predictor and BTB (see
+ *   Mipc::Step), so each detailed part starts with them warm.
+ *   Fetch then stops and the pipeline drains before going functional
+ *   again. Fetch only stops when a restart cannot lose a delay slot:
+ *   the last fetched instruction is not a branch and no interlock is
+ *   about to refetch one.
+ *
+ *------------------------------------------------------------------------
+ */
+void
+Mipc::Sample (void)
+{
+   double cpi;
+
+   if (_sampleDrain) {
+      if (_fd->_ins || _de->_ins || _em->_ins || _mw->_ins || _stallFetch)
+         return;
+      _sampleDrain = FALSE;
+      FastForward (_sampleInterval - _sampleWarmup - _sampleWindow, 0);
+      _sampleStart = _nfetched;
+      _predArmed = FALSE;
+      return;
+   }
+
+   if (!_sampleMeasuring) {
+      if (_nfetched - _sampleStart >= _sampleWarmup) {
+         _sampleMeasuring = TRUE;
+         _sampleMark = _nfetched;
+         _sampleCycle = SIM_TIME;
+      }
+   }
+   else if (_nfetched - _sampleMark >= _sampleWindow
+            && !IsControl (_fd->_ins) && !_interlock) {
+      cpi = ((double)(SIM_TIME - _sampleCycle))/(_nfetched - _sampleMark);
+      _samples++;
+      _sampleCpiSum += cpi;
+      _sampleCpiSumSq += cpi*cpi;
+      _sampleMeasuring = FALSE;
+      _sampleDrain = TRUE;
+   }
+}
+
+void
+Mipc::EndSimulation (void)
+{
    MipcDumpstats();
    Log::CloseLog();
    
@@ -73,14 +255,19 @@ void
 Mipc::MipcDumpstats()
 {
   Log l('*');
+  LL cycles = _timing ? _timing->Cycles () : SIM_TIME;
   l.startLogging = 0;
 
   l.print ("");
   l.print ("************************************************************");
   l.print ("");
+  if (_ffInsts)
+     l.print ("Fast-forwarded instructions: %llu (%llu blocks translated)", _ffInsts, _ffBlocks);
   l.print ("Number of instructions: %llu", _nfetched);
-  l.print ("Number of simulated cycles: %llu", SIM_TIME);
-  l.print ("CPI: %.2f", ((double)SIM_TIME)/_nfetched);
+  l.print ("Number of simulated cycles: %llu", cycles);
+  l.print ("CPI: %.2f", ((double)cycles)/_nfetched);
+  if (_timing)
+     _timing->Dumpstats (l);
   l.print ("Int Conditional Branches: %llu", _em->_num_cond_br);
   l.print ("Jump and Link: %llu", _em->_num_jal);
   l.print ("Jump Register: %llu", _em->_num_jr);
@@ -91,6 +278,22 @@ Mipc::MipcDumpstats()
   l.print ("Number of syscall emulated stores: %llu", _sys->_num_store);
   l.print ("Number of syscalls: %llu", _num_sys);
   l.print ("Number of load stalls: %llu", _load_stall);
+  l.print ("Bypassed operands: EX->EX %llu, MEM->EX %llu", _bypassEx, _bypassMem);
+  l.print ("Branch predictor: %s, %llu branches, %llu mispredicted (%.2f%%)", _bp->_name,
+           _brResolved, _brMispredicts, _brResolved ? 100.0*_brMispredicts/_brResolved : 0.0);
+  if (_bp->_lookups)
+     l.print ("BTB hits: %llu of %llu lookups", _bp->_btbHits, _bp->_lookups);
+  if (_decodeCache)
+     l.print ("Decode cache hits: %llu, misses: %llu", _decodeHits, _decodeMisses);
+  if (_samples) {
+     // normal approximation, 95% two-sided
+     double mean = _sampleCpiSum/_samples;
+     double var = _samples > 1 ? (_sampleCpiSumSq - _samples*mean*mean)/(_samples - 1) : 0;
+     double half = 1.96*sqrt((var > 0 ? var : 0)/_samples);
+
+     l.print ("Sampled CPI: %.4f +/- %.4f (95%% confidence, %.2f%%)", mean, half, 100*half/mean);
+     l.print ("Sampled windows: %llu of %llu instructions, every %llu", _samples, _sampleWindow, _sampleInterval);
+  }
   l.print ("");
 
 }
@@ -143,15 +346,56 @@ Mipc::Reboot (char *image)
       _num_jr = 0;
       _num_sys = 0;
       _load_stall = 0;
+      _bypassEx = 0;
+      _bypassMem = 0;
+      _brResolved = 0;
+      _brMispredicts = 0;
+      _ffInsts = 0;
+      _ffBlocks = 0;
+      _transCache = NULL;
+      _timing = NULL;
+
+      // Sampling: the pipeline starts empty, so the first unit starts functional
+      _sampleInterval = ParamGetLL ("Mipc.SampleInterval");
+      _sampleWarmup = ParamGetLL ("Mipc.SampleWarmup");
+      _sampleWindow = ParamGetLL ("Mipc.SampleWindow");
+      if (_sampleInterval && (!_sampleWindow || _sampleInterval <= _sampleWarmup + _sampleWindow))
+         fatal_error ("Mipc.SampleInterval must exceed Mipc.SampleWarmup + Mipc.SampleWindow");
+      _sampleDrain = _sampleInterval ? TRUE : FALSE;
+      _sampleMeasuring = FALSE;
+      _sampleStart = 0;
+      _samples = 0;
+      _sampleCpiSum = 0;
+      _sampleCpiSumSq = 0;
 
       _fd = new FetchDecode();
       _de = new DecodeExec();
       _em = new ExecMem();
       _mw = new MemWb();
 
+      _deNext = new DecodeExec();
+      _emNext = new ExecMem();
+      _mwNext = new MemWb();
+
+      // Decode cache size must be a power of two, 0 disables it
+      unsigned int entries = ParamGetInt ("Mipc.DecodeCache");
+      if (entries & (entries - 1))
+         fatal_error ("Mipc.DecodeCache must be a power of two, got %u", entries);
+      _decodeCache = entries ? new DecodedIns[entries] : NULL;
+      _decodeCacheMask = entries - 1;
+      _decodeHits = 0;
+      _decodeMisses = 0;
+
       _stallFetch = FALSE;
       _stallDec = FALSE;
 
+      _bp = new BranchPredictor (ParamGetString ("Mipc.BranchPredictor"),
+                                 ParamGetInt ("Mipc.BPredEntries"),
+                                 ParamGetInt ("Mipc.BTBEntries"),
+                                 ParamGetInt ("Mipc.BPredHistory"));
+      _predArmed = FALSE;
+      _brPending = FALSE;
+
       _de->_opControl = _em->func_sll;
 
       _sim_exit = 0;
@@ -12,6 +12,10 @@ class FetchDecode;
 class DecodeExec;
 class ExecMem;
 class MemWb;
+class DecodedIns;
+class TransBlock;
+class BranchPredictor;
+class TimingModel;
 
 typedef unsigned Bool;
 #define TRUE 1
@@ -52,34 +56,72 @@ public:
 				// "image" = file name for new memory
 				// image if any.
 
+   void Posedge (void);		// Fetch work done @posedge
+   void Negedge (void);		// Fetch work done @negedge
+   void EndSimulation (void);	// Dumps statistics and exits
+   void Sample (void);		// Sampling window control @negedge
+   void FastForward (LL count, unsigned int stopPc);
+				// Functional execution up to "count"
+				// instructions or PC "stopPc", no timing
+   void Step (DecodeExec *de, ExecMem *em, MemWb *mw, unsigned int *npc);
+				// Functionally executes one instruction
+   void TimingLoop (void);	// Functional execution timed by _timing
+   TransBlock *Translate (unsigned int pc);
+				// Fast-forward block starting at "pc"
+   unsigned int RunBlock (TransBlock *b, ExecMem *em, MemWb *mw);
+				// Runs "b", returns the next PC
+
    void MipcDumpstats();			// Prints simulation statistics
    void fake_syscall (unsigned int pc);	// System call interface
 
+   /* bypass network: a source register's value as seen by a stage whose
+      older instructions are "em" (EX/MEM, may be NULL) and "mw" (MEM/WB) */
+   unsigned int BypassGpr (unsigned int reg, ExecMem *em, MemWb *mw);
+   unsigned int BypassFpr (unsigned int reg, ExecMem *em, MemWb *mw);
+   unsigned int BypassHi (ExecMem *em, MemWb *mw);
+   unsigned int BypassLo (ExecMem *em, MemWb *mw);
+
    /* processor state */
    FetchDecode *_fd;
    DecodeExec *_de;
    ExecMem *_em;
    MemWb *_mw;
 
+   /* next-cycle latches: filled @posedge, committed with copy() @negedge */
+   DecodeExec *_deNext;
+   ExecMem *_emNext;
+   MemWb *_mwNext;
+
+   /* direct-mapped decode cache, indexed by PC */
+   DecodedIns *_decodeCache;
+   unsigned int _decodeCacheMask;	// entries - 1, no cache when _decodeCache is NULL
+
+   /* model timing the functional execution instead of the pipeline */
+   TimingModel *_timing;
+
+   /* fast-forward translation cache, direct-mapped by PC, allocated on use */
+   TransBlock *_transCache;
+   unsigned int _transCacheMask;
+
    unsigned int _ins;         // instruction register
    Bool     _stallFetch;
+   Bool     _fetchStall;      // _stallFetch sampled @posedge
    Bool     _stallDec;
 
+   /* front end: prediction @fetch, checked when the branch resolves in EX */
+   BranchPredictor *_bp;
+   Bool     _predArmed;       // redirect to _predTarget after fetching _predSlot
+   unsigned int _predSlot, _predTarget;
+   Bool     _brPending;       // a branch resolved @posedge, next fetch checks
+   unsigned int _brActual;    // its actual PC after the delay slot
+
    unsigned int 	_gpr[32];		// general-purpose integer registers
-   unsigned int   _gprState[34];
-   unsigned int   _gprCycles[34];  
 
    union {
       unsigned int l[2];
       float f[2];
       double d;
    } _fpr[16];					// floating-point registers (paired)
-   union {
-      unsigned int l[2];
-      float f[2];
-      double d;
-   } _fprState[16];
-   unsigned int   _fprCycles[16];
 
    unsigned int _hi, _lo; 			// mult, div destination
    unsigned int	_pc;				// Program counter
@@ -99,16 +141,32 @@ public:
    LL   _fpinst;
    LL   _num_sys;
    LL   _load_stall;
+   LL   _bypassEx;		// operands taken from EX/MEM
+   LL   _bypassMem;		// operands taken from MEM/WB
+   LL   _brResolved;
+   LL   _brMispredicts;
+   LL   _decodeHits;
+   LL   _decodeMisses;
+   LL   _ffInsts;		// instructions run by FastForward()
+   LL   _ffBlocks;		// blocks translated by FastForward()
+
+   /* sampled simulation: functional runs between detailed windows */
+   LL   _sampleInterval;	// instructions per sampling unit, 0 = off
+   LL   _sampleWarmup;		// detailed instructions before measuring
+   LL   _sampleWindow;		// detailed instructions measured
+   Bool _sampleDrain;		// fetch off until the pipeline is empty
+   Bool _sampleMeasuring;
+   LL   _sampleStart;		// _nfetched at the start of the unit
+   LL   _sampleMark;		// _nfetched when measuring started
+   LL   _sampleCycle;		// SIM_TIME when measuring started
+   LL   _samples;		// windows measured
+   double _sampleCpiSum, _sampleCpiSumSq;
 
    Mem	*_mem;	// attached memory (not a cache)
 
    Log	_l;
    int  _sim_exit;		// 1 on normal termination
 
-   unsigned int _scyc1, _scyc2;
-   unsigned int _fcyc;
-   unsigned int _dcyc;
-
    FILE *_debugLog;
 };
 
@@ -0,0 +1,268 @@
+#include "ooo.h"
+
+OutOfOrderTiming::OutOfOrderTiming (int width, int robSize, int iqSize,
+                                    int lsqSize, int renameRegs)
+{
+   int i;
+
+   if (width < 1 || robSize < 1 || iqSize < 1 || lsqSize < 1 || renameRegs < 1)
+      fatal_error ("Mipc out-of-order sizes must be positive");
+
+   _width = width;
+   _memPorts = width > 1 ? width/2 : 1;
+   _robSize = robSize;
+   _iqSize = iqSize;
+   _lsqSize = lsqSize;
+   _renameRegs = renameRegs;
+
+   for (i = 0; i < TIMING_REGS; i++)
+      _ready[i] = 0;
+
+   _fetchCycle = 0;
+   _fetchSlots = 0;
+   _groupEnd = FALSE;
+   _redirect = 0;
+   _slot = 0;
+
+   _dispatchCycle = 0;
+   _dispatchSlots = 0;
+   _robCommit = new LL[robSize];
+   _lsqCommit = new LL[lsqSize];
+   _lsqAddr = new unsigned int[lsqSize];
+   _lsqStore = new Bool[lsqSize];
+   _lsqReady = new LL[lsqSize];
+   _regCommit = new LL[renameRegs];
+   _iqIssue = new LL[iqSize];
+   for (i = 0; i < iqSize; i++)
+      _iqIssue[i] = 0;
+   _n = _nMem = _nWrites = 0;
+
+   for (i = 0; i < OOO_CYCLES; i++) {
+      _issueTag[i] = ~(LL)0;
+      _issueCount[i] = 0;
+      _memCount[i] = 0;
+   }
+
+   _commitCycle = 0;
+   _commitSlots = 0;
+
+   _stallFetch = _stallRob = _stallIq = _stallLsq = _stallRegs = _stallWidth = 0;
+   _forwarded = 0;
+   _syscalls = 0;
+}
+
+OutOfOrderTiming::~OutOfOrderTiming (void)
+{
+   delete [] _robCommit;
+   delete [] _lsqCommit;
+   delete [] _lsqAddr;
+   delete [] _lsqStore;
+   delete [] _lsqReady;
+   delete [] _regCommit;
+   delete [] _iqIssue;
+}
+
+/*
+ * Claim an issue slot in "cycle" if one is left
+ */
+Bool
+OutOfOrderTiming::IssueSlot (LL cycle, Bool mem)
+{
+   int i = cycle % OOO_CYCLES;
+
+   if (_issueTag[i] != cycle) {
+      _issueTag[i] = cycle;
+      _issueCount[i] = 0;
+      _memCount[i] = 0;
+   }
+   if (_issueCount[i] == _width || (mem && _memCount[i] == _memPorts))
+      return FALSE;
+   _issueCount[i]++;
+   if (mem)
+      _memCount[i]++;
+   return TRUE;
+}
+
+/*
+ * Stages, for an instruction fetched in cycle F:
+ *  - rename/dispatch in order from F+2, once there is a ROB entry, an
+ *    issue queue entry, an LSQ entry for loads and stores and a free
+ *    physical register for each destination. An uncommitted write holds
+ *    one register beyond the architectural ones, so the k-th write waits
+ *    for the commit of write k - renameRegs; LSQ and ROB entries free
+ *    at commit, queue entries at issue.
+ *  - issue out of order, no earlier than the cycle after dispatch, when
+ *    the sources are ready and a slot (and memory port) is free. lwl
+ *    and lwr also wait for the register they merge into. Loads also
+ *    wait for the youngest older store to the same word still in the
+ *    LSQ, whose data is forwarded; addresses are known, so
+ *    disambiguation is perfect.
+ *  - results after 1 cycle, 2 for loads; commit in order afterwards,
+ *    stores once their data is ready.
+ * A syscall waits to be the oldest instruction, executes at commit and
+ * flushes everything younger: fetch restarts after it.
+ */
+void
+OutOfOrderTiming::Add (TimedIns *t)
+{
+   LL fetch, dispatch, issue, done, commit, need, k;
+   LL *why;
+   Bool mem = t->_load || t->_store;
+   int i, e, s, writes;
+
+   // fetch
+   if (_fetchSlots == _width || _groupEnd) {
+      _fetchCycle++;
+      _fetchSlots = 0;
+      _groupEnd = FALSE;
+   }
+   if (_fetchCycle < _redirect) {
+      _fetchCycle = _redirect;
+      _fetchSlots = 0;
+   }
+   fetch = _fetchCycle;
+   _fetchSlots++;
+
+   if (_slot) {			// this is the delay slot
+      _slot = 0;
+      if (_slotMispredict)
+         _redirect = _slotResolve + 1;
+      if (_slotTaken || _slotMispredict)
+         _groupEnd = TRUE;
+   }
+
+   // rename/dispatch
+   dispatch = _dispatchCycle;
+   why = NULL;
+   if (fetch + 2 > dispatch) {
+      dispatch = fetch + 2;
+      why = &_stallFetch;
+   }
+   if (_n >= _robSize && (need = _robCommit[_n % _robSize] + 1) > dispatch) {
+      dispatch = need;
+      why = &_stallRob;
+   }
+   if (mem && _nMem >= _lsqSize && (need = _lsqCommit[_nMem % _lsqSize] + 1) > dispatch) {
+      dispatch = need;
+      why = &_stallLsq;
+   }
+   writes = (t->_dst[0] != 0) + (t->_dst[1] != 0);
+   for (i = 0; i < writes; i++)
+      if (_nWrites + i >= _renameRegs
+          && (need = _regCommit[(_nWrites + i) % _renameRegs] + 1) > dispatch) {
+         dispatch = need;
+         why = &_stallRegs;
+      }
+   e = 0;
+   for (i = 1; i < _iqSize; i++)
+      if (_iqIssue[i] < _iqIssue[e])
+         e = i;
+   if (_iqIssue[e] >= dispatch) {
+      dispatch = _iqIssue[e] + 1;
+      why = &_stallIq;
+   }
+   if (dispatch == _dispatchCycle && _dispatchSlots == _width) {
+      dispatch++;
+      why = &_stallWidth;
+   }
+   if (why)
+      *why += dispatch - _dispatchCycle;
+   if (dispatch > _dispatchCycle) {
+      _dispatchCycle = dispatch;
+      _dispatchSlots = 0;
+   }
+   _dispatchSlots++;
+
+   // issue
+   if (t->_syscall) {
+      issue = dispatch + 1;
+      if (_commitCycle + 1 > issue)
+         issue = _commitCycle + 1;
+   }
+   else {
+      issue = dispatch + 1;
+      for (i = 0; i < 2; i++)
+         if (_ready[t->_src[i]] > issue)
+            issue = _ready[t->_src[i]];
+      if (t->_load && _ready[t->_data] > issue)	// lwl/lwr merge register
+         issue = _ready[t->_data];
+      if (t->_load)			// youngest older store to the word
+         for (k = _nMem; k > 0 && k + _lsqSize > _nMem; k--) {
+            s = (k - 1) % _lsqSize;
+            if (_lsqStore[s] && _lsqAddr[s] == (t->_addr >> 2)) {
+               if (_lsqCommit[s] > dispatch) {
+                  if (_lsqReady[s] > issue)
+                     issue = _lsqReady[s];
+                  _forwarded++;
+               }
+               break;
+            }
+         }
+   }
+   while (!IssueSlot (issue, mem))
+      issue++;
+   _iqIssue[e] = issue;
+
+   done = issue + (t->_load ? 2 : 1);
+   for (i = 0; i < 2; i++)
+      if (t->_dst[i])
+         _ready[t->_dst[i]] = done;
+
+   // commit
+   commit = done;
+   if (t->_store && _ready[t->_data] > commit)
+      commit = _ready[t->_data];
+   if (commit < _commitCycle)
+      commit = _commitCycle;
+   if (commit == _commitCycle && _commitSlots == _width)
+      commit++;
+   if (commit > _commitCycle) {
+      _commitCycle = commit;
+      _commitSlots = 0;
+   }
+   _commitSlots++;
+
+   _robCommit[_n % _robSize] = commit;
+   _n++;
+   if (mem) {
+      s = _nMem % _lsqSize;
+      _lsqCommit[s] = commit;
+      _lsqAddr[s] = t->_addr >> 2;
+      _lsqStore[s] = t->_store;
+      _lsqReady[s] = _ready[t->_data] > issue + 1 ? _ready[t->_data] : issue + 1;
+      _nMem++;
+   }
+   for (i = 0; i < writes; i++) {
+      _regCommit[_nWrites % _renameRegs] = commit;
+      _nWrites++;
+   }
+
+   if (t->_branch) {
+      _slot = 1;
+      _slotTaken = t->_taken;
+      _slotMispredict = t->_mispredict;
+      _slotResolve = issue;
+   }
+   if (t->_syscall) {
+      _syscalls++;
+      _redirect = commit + 1;
+      _groupEnd = TRUE;
+   }
+}
+
+LL
+OutOfOrderTiming::Cycles (void)
+{
+   return _commitCycle + 1;
+}
+
+void
+OutOfOrderTiming::Dumpstats (Log &l)
+{
+   l.print ("Out-of-order: width %d, ROB %u, issue queue %d, LSQ %u, %u rename registers",
+            _width, _robSize, _iqSize, _lsqSize, _renameRegs);
+   l.print ("IPC: %.2f", _n ? ((double)_n)/Cycles () : 0.0);
+   l.print ("Dispatch cycles lost: fetch %llu, ROB %llu, issue queue %llu, LSQ %llu, registers %llu, width %llu",
+            _stallFetch, _stallRob, _stallIq, _stallLsq, _stallRegs, _stallWidth);
+   l.print ("Loads forwarded from stores: %llu, syscalls committed: %llu", _forwarded, _syscalls);
+}
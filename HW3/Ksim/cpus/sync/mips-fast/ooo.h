@@ -0,0 +1,67 @@
+#ifndef __OOO_H__
+#define __OOO_H__
+
+#include "timing.h"
+
+#define OOO_CYCLES	4096		// issue bookkeeping horizon, cycles
+
+/*
+ * Out-of-order core: in-order fetch and rename/dispatch, dataflow issue
+ * from a unified issue queue, in-order commit from a reorder buffer.
+ * "width" instructions per cycle at every stage.
+ */
+class OutOfOrderTiming : public TimingModel {
+public:
+   OutOfOrderTiming (int width, int robSize, int iqSize, int lsqSize, int renameRegs);
+   ~OutOfOrderTiming ();
+
+   void Add (TimedIns *t);
+   LL Cycles (void);
+   void Dumpstats (Log &l);
+
+   int _width;
+   int _memPorts;		// loads and stores issued per cycle
+   unsigned int _robSize, _lsqSize;
+   int _iqSize;
+   unsigned int _renameRegs;	// physical registers beyond the architectural ones
+
+   LL _ready[TIMING_REGS];	// cycle the current mapping's value is ready
+
+   /* fetch groups, as in InOrderTiming */
+   LL _fetchCycle;
+   int _fetchSlots;
+   Bool _groupEnd;
+   LL _redirect;
+   int _slot;
+   Bool _slotTaken, _slotMispredict;
+   LL _slotResolve;
+
+   /* rename/dispatch */
+   LL _dispatchCycle;
+   int _dispatchSlots;
+   LL *_robCommit;		// commit cycle of the last _robSize instructions
+   LL *_lsqCommit;		// ... of the last _lsqSize loads and stores
+   unsigned int *_lsqAddr;	// their word addresses
+   Bool *_lsqStore;		// TRUE for stores
+   LL *_lsqReady;		// store data ready
+   LL *_regCommit;		// ... of the last _renameRegs register writes
+   LL *_iqIssue;		// issue cycle of each queue entry's occupant
+   LL _n, _nMem, _nWrites;
+
+   /* issue */
+   LL _issueTag[OOO_CYCLES];
+   int _issueCount[OOO_CYCLES], _memCount[OOO_CYCLES];
+
+   /* commit */
+   LL _commitCycle;
+   int _commitSlots;
+
+   /* statistics: dispatch cycles lost, by what was full */
+   LL _stallFetch, _stallRob, _stallIq, _stallLsq, _stallRegs, _stallWidth;
+   LL _forwarded;		// loads fed by an in-flight store
+   LL _syscalls;
+
+private:
+   Bool IssueSlot (LL cycle, Bool mem);
+};
+#endif
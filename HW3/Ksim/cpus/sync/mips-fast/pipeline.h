@@ -9,6 +9,8 @@ class FetchDecode;
 class DecodeExec;
 class ExecMem;
 class MemWb;
+class DecodedIns;
+class TransBlock;
 
 typedef unsigned Bool;
 typedef unsigned long long LL;
@@ -17,6 +19,7 @@ class FetchDecode {
 public:
     unsigned int _ins;
     unsigned int _pc;
+    Bool _bubble;			// inserted by fetch, not counted in _nfetched
 
     FetchDecode ();
     ~FetchDecode ();
@@ -44,18 +47,61 @@ public:
 
     unsigned int _sreg1, _sreg2;
     unsigned int _freg;
+    Bool		_readFreg;			// 1 if _freg is read ($f0 included)
+    Bool		_regTarget;			// 1 if _btgt is the value of _sreg1
 
     void (*_opControl)(ExecMem*, unsigned);
     void (*_memOp)(Mipc*, MemWb*);
 
-    DecodeExec (FetchDecode *fd);
     DecodeExec ();
     ~DecodeExec ();
 
+    void Latch (FetchDecode *fd);	// Sample the IF/ID register into this latch
+
     void Dec (Mipc* mc, ExecMem* em, MemWb* mw, unsigned int ins);			// Decoder function
+    void CachedDec (Mipc* mc, ExecMem* em, MemWb* mw, unsigned int ins);		// Dec through the decode cache
+    void ReadOperands (Mipc* mc);		// Re-read the source registers Dec named
     void copy (DecodeExec *de);
 };
 
+// Decode cache entry: the latch as Dec left it
+class DecodedIns {
+public:
+    Bool _valid;
+    unsigned int _pc, _ins;			// tag: a PC and the word decoded there
+
+    DecodeExec _de;
+
+    DecodedIns () { _valid = 0; }
+};
+
+// Fast-forward translation: a basic block of pre-decoded instructions
+
+#define FF_BLOCK_MAX	32		// instructions per block, delay slot included
+
+#define FF_ALU		0		// kinds of work, in RunBlock's dispatch order
+#define FF_MEM		1
+#define FF_BRANCH	2
+#define FF_SYSCALL	3
+
+class TransIns {
+public:
+    DecodeExec _de;			// Dec() output; operands re-read on each run
+    unsigned int _kind;
+};
+
+class TransBlock {
+public:
+    Bool _valid;
+    unsigned int _pc;			// tag: PC of the first instruction
+    int _n;				// instructions in the block
+    TransBlock *_next[2];		// chained successor: fall-through, taken
+
+    TransIns _ins[FF_BLOCK_MAX];
+
+    TransBlock () { _valid = 0; _next[0] = _next[1] = NULL; }
+};
+
 class ExecMem {
 public:
     unsigned int _ins;
@@ -92,11 +138,13 @@ public:
 
     unsigned int _sreg2;
     unsigned int _freg;
+    Bool _readFreg;
 
-    ExecMem (DecodeExec *de);
     ExecMem ();
     ~ExecMem ();
 
+    void Latch (DecodeExec *de);	// Sample the ID/EX register into this latch
+
     void copy (ExecMem *em);
 
     // EXE stage definitions
@@ -181,10 +229,11 @@ public:
 
     void (*_memOp)(Mipc*, MemWb*);
 
-    MemWb (ExecMem* em);
     MemWb ();
     ~MemWb ();
 
+    void Latch (ExecMem *em);		// Sample the EX/MEM register into this latch
+
     void copy (MemWb *mw);
 
     // MEM stage definitions
@@ -0,0 +1,39 @@
+#ifndef __TIMING_H__
+#define __TIMING_H__
+
+#include "mips.h"
+
+/*
+ * Timing models driven by functional execution (Mipc::TimingLoop): the
+ * instructions are executed first, then handed in program order to a
+ * model that only schedules them. Registers are numbered 1-31 for the
+ * integer file, TIMING_FPR+n for FP register n, then HI and LO; 0 is
+ * "none" and never waits.
+ */
+
+#define TIMING_FPR	32
+#define TIMING_HI	64
+#define TIMING_LO	65
+#define TIMING_REGS	66
+
+class TimedIns {
+public:
+   unsigned int _pc;
+   unsigned int _src[2];	// read in EX
+   unsigned int _data;		// read in MEM: store data, lwl/lwr merge
+   unsigned int _dst[2];	// written (mult/div write HI and LO)
+   Bool _load, _store;
+   unsigned int _addr;		// effective address of a load or store
+   Bool _branch, _taken, _mispredict;
+   Bool _syscall;		// serialising, and fetch restarts after it
+};
+
+class TimingModel {
+public:
+   virtual ~TimingModel () { }
+
+   virtual void Add (TimedIns *t) = 0;	// Schedule the next instruction
+   virtual LL Cycles (void) = 0;	// Cycles to retire all added so far
+   virtual void Dumpstats (Log &l) = 0;	// Model-specific statistics
+};
+#endif
@@ -12,6 +12,14 @@ public:
   
    FAKE_SIM_TEMPLATE;
 
+   void Posedge (void);		// Work done @posedge
+   void Negedge (void);		// Work done @negedge
+
    Mipc *_mc;
+   /* signals sampled @posedge and used @negedge */
+   unsigned int _ins;
+   unsigned int _pc;
+   Bool _isSyscall;
+   Bool _isIllegalOp;
 };
 #endif
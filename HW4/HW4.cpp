@@ -17,6 +17,7 @@
 #include <iomanip>
 #include <limits.h>
 #include <ctime>
+#include "../common/pin_runtime.H"
 
 
 using std::cerr;
@@ -70,11 +71,8 @@ typedef struct nru_entry
     BOOL valid;
 } NRU_ENTRY;
 
-static UINT64 ff_cnt = 0;
 static UINT64 FF_MUL = 1000000000;
 static UINT64 instrument_cnt = 1000000000;
-static UINT64 icount = 0;
-static UINT64 pre_icount = 0;
 
 static vector<vector<CACHE_ENTRY*>> L1;
 static vector<vector<CACHE_ENTRY*>> L2;
@@ -133,21 +131,6 @@ INT32 Usage()
 // Analysis routines
 /* ===================================================================== */
 
-VOID InsCount(UINT32 c)
-{
-    pre_icount = icount; // TODO: also try keeping previous BB ins count rather
-    icount += c;
-    // *out << icount << endl;
-}
-
-INT32 FastForward(void) {
-    return ((pre_icount >= ff_cnt) && (pre_icount < ff_cnt + instrument_cnt));
-}
-
-INT32 Terminate(void) {
-    return (icount >= ff_cnt + instrument_cnt);
-}
-
 VOID lru(ADDRINT memAddr, UINT64 size) {
     // *out << "lru" << endl;
     ADDRINT startAddrL1 = memAddr >> 6;
@@ -457,7 +440,9 @@ void nru(ADDRINT memAddr, UINT64 size) {
 }
 
 
-VOID Exit() {
+VOID Exit(THREADID tid) {
+    RuntimeSummary(*out);
+
     *out << "LRU stats: " << endl;
 
     tab_print("L1 accesses");
@@ -505,15 +490,13 @@ VOID Exit() {
 // Instrumentation callbacks
 /* ===================================================================== */
 
-VOID Instruction(INS ins, VOID* v) 
+VOID Instruction(INS ins) 
 {
     // Instruments memory accesses using a predicated call, i.e.
     // the instrumentation is called iff the instruction will actually be executed.
     //
     // On the IA-32 and Intel(R) 64 architectures conditional moves and REP 
     // prefixed instructions appear as predicated instructions in Pin.
-    INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)Terminate, IARG_END);
-    INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)Exit, IARG_END);
 
     UINT32 memOperands = INS_MemoryOperandCount(ins);
 
@@ -523,56 +506,46 @@ VOID Instruction(INS ins, VOID* v)
         UINT64 size = INS_MemoryOperandSize(ins, memOp);
 
         if (INS_MemoryOperandIsRead(ins, memOp)) {
-            INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)FastForward, IARG_END);
-            INS_InsertThenPredicatedCall(
-                ins, IPOINT_BEFORE, (AFUNPTR)lru,
+            insert_predicated_call(
+                ins, (AFUNPTR)lru,
                 IARG_MEMORYOP_EA, memOp,
                 IARG_UINT64, size,
                 IARG_END);
 
-            INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)FastForward, IARG_END);
-            INS_InsertThenPredicatedCall(
-                ins, IPOINT_BEFORE, (AFUNPTR)srrip,
+            insert_predicated_call(
+                ins, (AFUNPTR)srrip,
                 IARG_MEMORYOP_EA, memOp,
                 IARG_UINT64, size,
                 IARG_END);
 
-            INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)FastForward, IARG_END);
-            INS_InsertThenPredicatedCall(
-                ins, IPOINT_BEFORE, (AFUNPTR)nru,
+            insert_predicated_call(
+                ins, (AFUNPTR)nru,
                 IARG_MEMORYOP_EA, memOp,
                 IARG_UINT64, size,
                 IARG_END);
         }
 
         if (INS_MemoryOperandIsWritten(ins, memOp)) {
-            INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)FastForward, IARG_END);
-            INS_InsertThenPredicatedCall(
-                ins, IPOINT_BEFORE, (AFUNPTR)lru,
+            insert_predicated_call(
+                ins, (AFUNPTR)lru,
                 IARG_MEMORYOP_EA, memOp,
                 IARG_UINT64, size,
                 IARG_END);
 
-            INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)FastForward, IARG_END);
-            INS_InsertThenPredicatedCall(
-                ins, IPOINT_BEFORE, (AFUNPTR)srrip,
+            insert_predicated_call(
+                ins, (AFUNPTR)srrip,
                 IARG_MEMORYOP_EA, memOp,
                 IARG_UINT64, size,
                 IARG_END);
 
-            INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)FastForward, IARG_END);
-            INS_InsertThenPredicatedCall(
-                ins, IPOINT_BEFORE, (AFUNPTR)nru,
+            insert_predicated_call(
+                ins, (AFUNPTR)nru,
                 IARG_MEMORYOP_EA, memOp,
                 IARG_UINT64, size,
                 IARG_END);
         }
         
     }
-
-    UINT32 num_ins = 1;
-    INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)InsCount, IARG_UINT32, num_ins, IARG_END);
-
 }
 
 /*!
@@ -583,25 +556,23 @@ VOID Instruction(INS ins, VOID* v)
  * @param[in]   v        value specified by the tool in the TRACE_AddInstrumentFunction
  *                       function call
  */
-// VOID Trace(TRACE trace, VOID* v)
-// {
-//     // Visit every basic block in the trace
-//     for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
-//     {
-//         BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)Terminate, IARG_END);
-//         BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)Exit, IARG_END);
-
-//         // Insert a call to CountBbl() before every basic bloc, passing the number of instructions
-//         BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)InsCount, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
-
-//         BOOL break_flag = 1;
-//         for (INS ins = BBL_InsHead(bbl); break_flag && INS_Valid(ins); ins = INS_Next(ins)) 
-//         {
-//             break_flag = (ins != BBL_InsTail(bbl));
-//             Instruction(ins);
-//         }
-//     }
-// }
+VOID Trace(TRACE trace, VOID* v)
+{
+    // Visit every basic block in the trace
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        // Markers, block count and the terminate check; nothing else while fast-forwarding
+        if (RuntimeInstrumentBbl(bbl))
+            continue;
+
+        BOOL break_flag = 1;
+        for (INS ins = BBL_InsHead(bbl); break_flag && INS_Valid(ins); ins = INS_Next(ins)) 
+        {
+            break_flag = (ins != BBL_InsTail(bbl));
+            Instruction(ins);
+        }
+    }
+}
 
 // TODO: there was an instruction to increase the number of threads. See if useful
 
@@ -615,7 +586,7 @@ VOID Instruction(INS ins, VOID* v)
 VOID Fini(INT32 code, VOID* v)
 {
     *out << "Finished Binary" << endl;
-    *out << "Instruction number: " << icount << endl;
+    RuntimeSummary(*out);
 }
 
 /*!
@@ -636,17 +607,9 @@ int main(int argc, char* argv[])
 
     string fileName = KnobOutputFile.Value();
 
-    if (!fileName.empty())
-    {
-        out = new std::ofstream(fileName.c_str());
-    }
-
-    ff_cnt = KnobFastForward * FF_MUL;
-
+    out = RuntimeOpenOutput(fileName);
 
-    cerr << "Fast Forward amount :" << ff_cnt << endl;
-    cerr << "Output File name :" << fileName << endl;
-    cerr << "Cutoff Point :" << ff_cnt + instrument_cnt << endl;
+    RuntimeInit(KnobFastForward * FF_MUL, instrument_cnt, (AFUNPTR)Exit);
 
     for (int i=0; i < L1_SIZE; i++){
         vector<CACHE_ENTRY*> v;
@@ -700,18 +663,12 @@ int main(int argc, char* argv[])
     }
 
     // Register function to be called to instrument traces
-    INS_AddInstrumentFunction(Instruction, 0);
+    TRACE_AddInstrumentFunction(Trace, 0);
 
     // Register function to be called when the application exits
     PIN_AddFiniFunction(Fini, 0);
 
-    cerr << "===============================================" << endl;
-    cerr << "This application is instrumented by HW1" << endl;
-    if (!KnobOutputFile.Value().empty())
-    {
-        cerr << "See file " << KnobOutputFile.Value() << " for analysis results" << endl;
-    }
-    cerr << "===============================================" << endl;
+    RuntimeBanner("HW4", KnobOutputFile.Value());
 
     // Start the program, never returns
     PIN_StartProgram();